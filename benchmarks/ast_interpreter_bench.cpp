@@ -0,0 +1,408 @@
+// Evaluates a large random expression tree with 30 node types, built
+// three ways: with variant_ptr children, with a virtual eval() on a
+// common base class, and with std::variant nodes.
+//
+// g++ -O2 -std=c++17 -I.. ast_interpreter_bench.cpp -o ast_interpreter_bench
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "bench_harness.h"
+#include "variant_ptr.h"
+
+using namespace lius_tools;
+
+namespace {
+constexpr int num_unary_ops = 7;
+constexpr int num_binary_ops = 20;
+constexpr int num_variables = 8;
+constexpr size_t num_nodes_target = 1 << 18;
+
+template <int Op>
+int64_t apply_unary(int64_t x) {
+  switch (Op) {
+    case 0: return -x;
+    case 1: return !x;
+    case 2: return x < 0 ? -x : x;
+    case 3: return (x & 0xffff) * (x & 0xffff);
+    case 4: return x / 2;
+    case 5: return x + 1;
+    default: return x - 1;
+  }
+}
+
+template <int Op>
+int64_t apply_binary(int64_t a, int64_t b) {
+  switch (Op) {
+    case 0: return a + b;
+    case 1: return a - b;
+    case 2: return (a & 0xffff) * (b & 0xffff);
+    case 3: return b ? a / b : 0;
+    case 4: return b ? a % b : 0;
+    case 5: return a < b ? a : b;
+    case 6: return a < b ? b : a;
+    case 7: return a < b;
+    case 8: return a <= b;
+    case 9: return a > b;
+    case 10: return a >= b;
+    case 11: return a == b;
+    case 12: return a != b;
+    case 13: return a && b;
+    case 14: return a || b;
+    case 15: return a ^ b;
+    case 16: return a << (b & 7);
+    case 17: return a >> (b & 7);
+    case 18: return a & b;
+    default: return a | b;
+  }
+}
+
+// All three representations are allocated from the same kind of
+// arena, so that they only differ in how they dispatch.
+class Arena {
+ public:
+  template <typename T, typename... TArgs>
+  T* make(TArgs&&... args) {
+    constexpr size_t chunk_size = 1 << 20;
+    size_t offset = (used_ + alignof(T) - 1) / alignof(T) * alignof(T);
+    if (chunks_.empty() || offset + sizeof(T) > chunk_size) {
+      chunks_.emplace_back(new char[chunk_size]);
+      offset = 0;
+    }
+    used_ = offset + sizeof(T);
+    return new (chunks_.back().get() + offset) T{std::forward<TArgs>(args)...};
+  }
+
+ private:
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  size_t used_ = 0;
+};
+
+// variant_ptr representation
+namespace vp {
+struct Const;
+struct Var;
+struct Select;
+template <int Op> struct Unary;
+template <int Op> struct Binary;
+
+template <typename TUnary, typename TBinary>
+struct node_ptr;
+
+template <int... Us, int... Bs>
+struct node_ptr<std::integer_sequence<int, Us...>,
+                std::integer_sequence<int, Bs...>> {
+  using type = variant_ptr<const Const, const Var, const Select,
+                           const Unary<Us>..., const Binary<Bs>...>;
+};
+
+using NodePtr = node_ptr<std::make_integer_sequence<int, num_unary_ops>,
+                         std::make_integer_sequence<int, num_binary_ops>>::type;
+
+struct Const { int64_t value; };
+struct Var { int index; };
+struct Select { NodePtr condition, if_true, if_false; };
+template <int Op> struct Unary { NodePtr operand; };
+template <int Op> struct Binary { NodePtr lhs, rhs; };
+
+struct Eval {
+  const int64_t* variables;
+
+  int64_t visit(const Const& node) const { return node.value; }
+  int64_t visit(const Var& node) const { return variables[node.index]; }
+  int64_t visit(const Select& node) const {
+    int64_t condition = node.condition.visit(*this);
+    int64_t if_true = node.if_true.visit(*this);
+    int64_t if_false = node.if_false.visit(*this);
+    return condition ? if_true : if_false;
+  }
+  template <int Op>
+  int64_t visit(const Unary<Op>& node) const {
+    return apply_unary<Op>(node.operand.visit(*this));
+  }
+  template <int Op>
+  int64_t visit(const Binary<Op>& node) const {
+    return apply_binary<Op>(node.lhs.visit(*this), node.rhs.visit(*this));
+  }
+};
+
+struct Builder {
+  using node_type = NodePtr;
+  Arena& arena;
+
+  NodePtr make_const(int64_t value) { return arena.make<Const>(value); }
+  NodePtr make_var(int index) { return arena.make<Var>(index); }
+  NodePtr make_select(NodePtr c, NodePtr t, NodePtr f) {
+    return arena.make<Select>(c, t, f);
+  }
+  template <int Op>
+  NodePtr make_unary(NodePtr operand) { return arena.make<Unary<Op>>(operand); }
+  template <int Op>
+  NodePtr make_binary(NodePtr lhs, NodePtr rhs) {
+    return arena.make<Binary<Op>>(lhs, rhs);
+  }
+};
+
+int64_t evaluate(const NodePtr& root, const int64_t* variables) {
+  return root.visit(Eval{variables});
+}
+}
+
+// Virtual function representation
+namespace virt {
+struct Node {
+  virtual ~Node() = default;
+  virtual int64_t eval(const int64_t* variables) const = 0;
+};
+
+struct Const : Node {
+  int64_t value;
+  explicit Const(int64_t v) : value(v) {}
+  int64_t eval(const int64_t*) const override { return value; }
+};
+
+struct Var : Node {
+  int index;
+  explicit Var(int i) : index(i) {}
+  int64_t eval(const int64_t* variables) const override {
+    return variables[index];
+  }
+};
+
+struct Select : Node {
+  const Node *condition, *if_true, *if_false;
+  Select(const Node* c, const Node* t, const Node* f) :
+      condition(c), if_true(t), if_false(f) {}
+  int64_t eval(const int64_t* variables) const override {
+    int64_t c = condition->eval(variables);
+    int64_t t = if_true->eval(variables);
+    int64_t f = if_false->eval(variables);
+    return c ? t : f;
+  }
+};
+
+template <int Op>
+struct Unary : Node {
+  const Node* operand;
+  explicit Unary(const Node* o) : operand(o) {}
+  int64_t eval(const int64_t* variables) const override {
+    return apply_unary<Op>(operand->eval(variables));
+  }
+};
+
+template <int Op>
+struct Binary : Node {
+  const Node *lhs, *rhs;
+  Binary(const Node* l, const Node* r) : lhs(l), rhs(r) {}
+  int64_t eval(const int64_t* variables) const override {
+    return apply_binary<Op>(lhs->eval(variables), rhs->eval(variables));
+  }
+};
+
+struct Builder {
+  using node_type = const Node*;
+  Arena& arena;
+
+  const Node* make_const(int64_t value) { return arena.make<Const>(value); }
+  const Node* make_var(int index) { return arena.make<Var>(index); }
+  const Node* make_select(const Node* c, const Node* t, const Node* f) {
+    return arena.make<Select>(c, t, f);
+  }
+  template <int Op>
+  const Node* make_unary(const Node* operand) {
+    return arena.make<Unary<Op>>(operand);
+  }
+  template <int Op>
+  const Node* make_binary(const Node* lhs, const Node* rhs) {
+    return arena.make<Binary<Op>>(lhs, rhs);
+  }
+};
+
+int64_t evaluate(const Node* root, const int64_t* variables) {
+  return root->eval(variables);
+}
+}
+
+// std::variant representation
+namespace stdv {
+struct Node;
+struct Const { int64_t value; };
+struct Var { int index; };
+struct Select { const Node *condition, *if_true, *if_false; };
+template <int Op> struct Unary { const Node* operand; };
+template <int Op> struct Binary { const Node *lhs, *rhs; };
+
+template <typename TUnary, typename TBinary>
+struct node_variant;
+
+template <int... Us, int... Bs>
+struct node_variant<std::integer_sequence<int, Us...>,
+                    std::integer_sequence<int, Bs...>> {
+  using type = std::variant<Const, Var, Select, Unary<Us>..., Binary<Bs>...>;
+};
+
+struct Node : node_variant<std::make_integer_sequence<int, num_unary_ops>,
+                           std::make_integer_sequence<int, num_binary_ops>>::type {
+  using variant::variant;
+};
+
+struct Eval {
+  const int64_t* variables;
+
+  int64_t operator()(const Const& node) const { return node.value; }
+  int64_t operator()(const Var& node) const { return variables[node.index]; }
+  int64_t operator()(const Select& node) const {
+    int64_t condition = std::visit(*this, *node.condition);
+    int64_t if_true = std::visit(*this, *node.if_true);
+    int64_t if_false = std::visit(*this, *node.if_false);
+    return condition ? if_true : if_false;
+  }
+  template <int Op>
+  int64_t operator()(const Unary<Op>& node) const {
+    return apply_unary<Op>(std::visit(*this, *node.operand));
+  }
+  template <int Op>
+  int64_t operator()(const Binary<Op>& node) const {
+    return apply_binary<Op>(std::visit(*this, *node.lhs),
+                            std::visit(*this, *node.rhs));
+  }
+};
+
+struct Builder {
+  using node_type = const Node*;
+  Arena& arena;
+
+  const Node* make_const(int64_t value) { return arena.make<Node>(Const{value}); }
+  const Node* make_var(int index) { return arena.make<Node>(Var{index}); }
+  const Node* make_select(const Node* c, const Node* t, const Node* f) {
+    return arena.make<Node>(Select{c, t, f});
+  }
+  template <int Op>
+  const Node* make_unary(const Node* operand) {
+    return arena.make<Node>(Unary<Op>{operand});
+  }
+  template <int Op>
+  const Node* make_binary(const Node* lhs, const Node* rhs) {
+    return arena.make<Node>(Binary<Op>{lhs, rhs});
+  }
+};
+
+int64_t evaluate(const Node* root, const int64_t* variables) {
+  return std::visit(Eval{variables}, *root);
+}
+}
+
+// Builds the same random tree in every representation, from the same
+// seed, and counts its nodes.
+template <typename TBuilder>
+class RandomTree {
+ public:
+  using node_type = typename TBuilder::node_type;
+
+  RandomTree(TBuilder builder, uint32_t seed) :
+      builder_(builder),
+      rng_(seed) {}
+
+  node_type build(int depth) {
+    ++num_nodes_;
+    std::uniform_int_distribution<int> pick_kind(0, 9);
+    int kind = depth == 0 ? pick_kind(rng_) % 2 : pick_kind(rng_);
+    if (kind == 0) {
+      return builder_.make_const(std::uniform_int_distribution<int>(-50, 50)(rng_));
+    }
+    if (kind == 1) {
+      return builder_.make_var(
+          std::uniform_int_distribution<int>(0, num_variables - 1)(rng_));
+    }
+    if (kind == 2) {
+      node_type c = build(depth - 1);
+      node_type t = build(depth - 1);
+      return builder_.make_select(c, t, build(depth - 1));
+    }
+    if (kind <= 4) {
+      int op = std::uniform_int_distribution<int>(0, num_unary_ops - 1)(rng_);
+      return make_unary(op, build(depth - 1),
+                        std::make_integer_sequence<int, num_unary_ops>{});
+    }
+    int op = std::uniform_int_distribution<int>(0, num_binary_ops - 1)(rng_);
+    node_type lhs = build(depth - 1);
+    return make_binary(op, lhs, build(depth - 1),
+                       std::make_integer_sequence<int, num_binary_ops>{});
+  }
+
+  size_t num_nodes() const { return num_nodes_; }
+
+ private:
+  template <int... Ops>
+  node_type make_unary(int op, node_type operand,
+                       std::integer_sequence<int, Ops...>) {
+    using maker = node_type (TBuilder::*)(node_type);
+    static constexpr maker makers[] = { &TBuilder::template make_unary<Ops>... };
+    return (builder_.*makers[op])(operand);
+  }
+
+  template <int... Ops>
+  node_type make_binary(int op, node_type lhs, node_type rhs,
+                        std::integer_sequence<int, Ops...>) {
+    using maker = node_type (TBuilder::*)(node_type, node_type);
+    static constexpr maker makers[] = { &TBuilder::template make_binary<Ops>... };
+    return (builder_.*makers[op])(lhs, rhs);
+  }
+
+  TBuilder builder_;
+  std::mt19937 rng_;
+  size_t num_nodes_ = 0;
+};
+
+template <typename TBuilder>
+std::vector<typename TBuilder::node_type> build_forest(
+    TBuilder builder, size_t& num_nodes) {
+  RandomTree<TBuilder> tree(builder, 2024);
+  std::vector<typename TBuilder::node_type> roots;
+  while (tree.num_nodes() < num_nodes_target) {
+    roots.push_back(tree.build(12));
+  }
+  num_nodes = tree.num_nodes();
+  return roots;
+}
+
+template <typename TRoots>
+void run_case(bench::harness& harness, const char* name,
+              const TRoots& roots, size_t num_nodes, int64_t& checksum) {
+  harness.run(name, num_nodes, [&]() {
+    int64_t variables[num_variables] = { 3, -7, 11, 0, 42, -1, 5, 9 };
+    int64_t sum = 0;
+    for (const auto& root : roots) {
+      sum += evaluate(root, variables);
+    }
+    bench::do_not_optimize(sum);
+    checksum = sum;
+  });
+}
+}
+
+int main(int argc, char *argv[])
+{
+  bench::harness harness(argc, argv);
+  Arena vp_arena, virt_arena, stdv_arena;
+  size_t vp_nodes = 0, virt_nodes = 0, stdv_nodes = 0;
+  auto vp_roots = build_forest(vp::Builder{vp_arena}, vp_nodes);
+  auto virt_roots = build_forest(virt::Builder{virt_arena}, virt_nodes);
+  auto stdv_roots = build_forest(stdv::Builder{stdv_arena}, stdv_nodes);
+
+  int64_t vp_checksum = 0, virt_checksum = 0, stdv_checksum = 0;
+  run_case(harness, "variant_ptr", vp_roots, vp_nodes, vp_checksum);
+  run_case(harness, "virtual functions", virt_roots, virt_nodes, virt_checksum);
+  run_case(harness, "std::variant", stdv_roots, stdv_nodes, stdv_checksum);
+
+  if (vp_checksum != virt_checksum || vp_checksum != stdv_checksum) {
+    std::cout << "Checksums differ: " << vp_checksum << " " << virt_checksum
+              << " " << stdv_checksum << std::endl;
+    return 1;
+  }
+  return 0;
+}
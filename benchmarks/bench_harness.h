@@ -0,0 +1,214 @@
+#ifndef _LIUS_TOOLS_BENCH_HARNESS_H_
+#define _LIUS_TOOLS_BENCH_HARNESS_H_
+
+// Minimal timing harness shared by the benchmark programs.
+//
+// Each case is run a few times and the fastest repetition is reported
+// in nanoseconds per dispatch. Passing --perf on the command line (or
+// setting VARIANT_PTR_BENCH_PERF=1) also reads the Linux hardware
+// performance counters around each repetition and reports cycles,
+// instructions, branch misses and L1 instruction cache misses per
+// dispatch. Counters that cannot be opened (no perf_event_open, a
+// restrictive perf_event_paranoid, a virtual machine without a PMU,
+// ...) are reported as n/a and the timings are still printed.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+class perf_counters {
+ public:
+  static constexpr int num_counters = 4;
+
+  perf_counters() {
+    for (int i = 0; i < num_counters; ++i) {
+      fds_[i] = -1;
+    }
+  }
+
+  ~perf_counters() {
+    close();
+  }
+
+  perf_counters(const perf_counters&) = delete;
+  perf_counters& operator=(const perf_counters&) = delete;
+
+  static const char* name(int counter) {
+    static const char* names[num_counters] = {
+      "cycles", "instructions", "branch-misses", "L1i-misses" };
+    return names[counter];
+  }
+
+  // Returns whether at least one counter could be opened
+  bool open() {
+#if defined(__linux__)
+    const uint32_t types[num_counters] = {
+      PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+      PERF_TYPE_HW_CACHE };
+    const uint64_t configs[num_counters] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_BRANCH_MISSES,
+      PERF_COUNT_HW_CACHE_L1I |
+          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) };
+    bool any_open = false;
+    for (int i = 0; i < num_counters; ++i) {
+      struct perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[i];
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fds_[i] = static_cast<int>(
+          syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+      any_open = any_open || fds_[i] >= 0;
+    }
+    return any_open;
+#else
+    return false;
+#endif
+  }
+
+  void close() {
+#if defined(__linux__)
+    for (int i = 0; i < num_counters; ++i) {
+      if (fds_[i] >= 0) {
+        ::close(fds_[i]);
+        fds_[i] = -1;
+      }
+    }
+#endif
+  }
+
+  bool available(int counter) const {
+    return fds_[counter] >= 0;
+  }
+
+  void start() {
+#if defined(__linux__)
+    for (int i = 0; i < num_counters; ++i) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void stop() {
+#if defined(__linux__)
+    for (int i = 0; i < num_counters; ++i) {
+      if (fds_[i] >= 0) {
+        ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+#endif
+  }
+
+  // Counter value since the last start(), or 0 if it is unavailable
+  uint64_t read(int counter) const {
+    uint64_t value = 0;
+#if defined(__linux__)
+    if (fds_[counter] < 0 ||
+        ::read(fds_[counter], &value, sizeof(value)) != sizeof(value)) {
+      return 0;
+    }
+#endif
+    return value;
+  }
+
+ private:
+  int fds_[num_counters];
+};
+
+class harness {
+ public:
+  harness(int argc, char *argv[]) {
+    const char* env = std::getenv("VARIANT_PTR_BENCH_PERF");
+    bool use_perf = env && std::string(env) == "1";
+    for (int i = 1; i < argc; ++i) {
+      use_perf = use_perf || std::string(argv[i]) == "--perf";
+    }
+    if (use_perf && !counters_.open()) {
+      std::cout << "# hardware counters unavailable, reporting timings only"
+                << std::endl;
+    }
+    use_perf_ = use_perf;
+  }
+
+  // Runs function (which performs num_dispatches dispatches) a few times
+  // and reports the fastest repetition.
+  template <typename TFunction>
+  void run(const std::string& name, size_t num_dispatches, TFunction&& function) {
+    double best_ns = 1e300;
+    uint64_t best_counts[perf_counters::num_counters] = {};
+    for (int rep = 0; rep < repetitions; ++rep) {
+      counters_.start();
+      auto start = std::chrono::steady_clock::now();
+      function();
+      auto stop = std::chrono::steady_clock::now();
+      counters_.stop();
+      double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+      if (ns < best_ns) {
+        best_ns = ns;
+        for (int i = 0; i < perf_counters::num_counters; ++i) {
+          best_counts[i] = counters_.read(i);
+        }
+      }
+    }
+
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << best_ns / num_dispatches << " ns";
+    if (use_perf_) {
+      for (int i = 0; i < perf_counters::num_counters; ++i) {
+        std::cout << "  " << perf_counters::name(i) << " ";
+        if (counters_.available(i)) {
+          std::cout << double(best_counts[i]) / num_dispatches;
+        }
+        else {
+          std::cout << "n/a";
+        }
+      }
+    }
+    std::cout << "  (per dispatch)" << std::endl;
+  }
+
+ private:
+  static constexpr int repetitions = 5;
+
+  perf_counters counters_;
+  bool use_perf_ = false;
+};
+
+// Keeps the compiler from optimizing away a benchmark's result
+template <typename T>
+void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const T* sink;
+  sink = &value;
+#endif
+}
+
+}
+
+#endif /* _LIUS_TOOLS_BENCH_HARNESS_H_ */
@@ -0,0 +1,246 @@
+// Reports the object code emitted per visitor for each dispatch
+// strategy, over growing alternative lists, and the shape of that code:
+// indirect branches (jump tables, thunk tables) versus conditional
+// branches (compare chains).
+//
+// For each strategy and alternative count, two translation units are
+// generated, one without visitors and one instantiating num_visitors
+// distinct visitors, and compiled with $CXX (default c++) -O2. The code
+// size per visitor is the growth of the .text, .rodata and .data.rel.ro
+// sections divided by num_visitors.
+//
+// g++ -O2 -std=c++17 code_size_bench.cpp -o code_size_bench
+// ./code_size_bench --write-baseline sizes.txt
+// ./code_size_bench --baseline sizes.txt --tolerance 10
+//
+// With --baseline, exits with a failure if any bytes-per-visitor figure
+// grew by more than --tolerance percent (default 10).
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr size_t num_visitors = 8;
+
+const char* strategies[] = {
+  "visit", "multi_dense", "multi_symmetric", "multi_sparse", "multi_type_only" };
+
+std::string source_dir() {
+  std::string file = __FILE__;
+  size_t slash = file.find_last_of('/');
+  return slash == std::string::npos ? "." : file.substr(0, slash);
+}
+
+std::string generate_visitor(const std::string& strategy, size_t k) {
+  std::ostringstream source;
+  std::string name = "Visitor" + std::to_string(k);
+  if (strategy == "visit") {
+    source << "struct " << name << " {\n"
+           << "  template <typename A> int visit(A& a) { return a.value * "
+           << k + 2 << "; }\n"
+           << "};\n"
+           << "int run" << k << "(APtr a) { return a.visit(" << name << "{}); }\n";
+    return source.str();
+  }
+  source << "struct " << name << " {\n";
+  if (strategy == "multi_symmetric") {
+    source << "  static constexpr bool symmetric = true;\n";
+  }
+  if (strategy == "multi_sparse") {
+    source << "  using sparse_cases = case_list<sparse_case<A0, A1>, sparse_case<A1, A0>>;\n"
+           << "  int visit_default(const APtr&, const APtr&) { return " << k << "; }\n";
+  }
+  if (strategy == "multi_type_only") {
+    source << "  static constexpr bool type_only = true;\n"
+           << "  template <typename A, typename B>\n"
+           << "  constexpr int visit(A, B) const { return A{}.value * " << k + 2
+           << " + B{}.value; }\n";
+  }
+  else {
+    source << "  template <typename A, typename B>\n"
+           << "  int visit(A& a, B& b) { return a.value * " << k + 2
+           << " + b.value; }\n";
+  }
+  source << "};\n"
+         << "int run" << k << "(APtr a, APtr b) {\n"
+         << "  " << name << " visitor;\n"
+         << "  return apply_multi_visitor<2>(visitor, a, b);\n"
+         << "}\n";
+  return source.str();
+}
+
+std::string generate_source(
+    const std::string& strategy, size_t num_alternatives, size_t visitors) {
+  std::ostringstream source;
+  source << "#include \"variant_ptr.h\"\n"
+         << "using namespace lius_tools;\n";
+  for (size_t i = 0; i < num_alternatives; ++i) {
+    source << "struct A" << i << " { int value = " << i << "; };\n";
+  }
+  source << "using APtr = variant_ptr<";
+  for (size_t i = 0; i < num_alternatives; ++i) {
+    source << (i ? ", " : "") << "A" << i;
+  }
+  source << ">;\n";
+  for (size_t k = 0; k < visitors; ++k) {
+    source << generate_visitor(strategy, k);
+  }
+  return source.str();
+}
+
+std::string run_command(const std::string& command) {
+  std::string output;
+  std::unique_ptr<FILE, int (*)(FILE*)> pipe(popen(command.c_str(), "r"), pclose);
+  if (!pipe) {
+    return output;
+  }
+  char buffer[4096];
+  while (size_t n = fread(buffer, 1, sizeof(buffer), pipe.get())) {
+    output.append(buffer, n);
+  }
+  return output;
+}
+
+bool compile(const std::string& source, const std::string& object_path) {
+  std::string source_path = object_path + ".cpp";
+  std::ofstream(source_path) << source;
+  const char* cxx = std::getenv("CXX");
+  std::string command = std::string(cxx ? cxx : "c++") +
+      " -std=c++17 -O2 -c " + source_path + " -o " + object_path +
+      " -I" + source_dir() + "/..";
+  bool ok = std::system(command.c_str()) == 0;
+  std::remove(source_path.c_str());
+  return ok;
+}
+
+// Bytes of code and dispatch tables in an object file
+size_t code_size(const std::string& object_path) {
+  std::istringstream sections(run_command("size -A " + object_path));
+  size_t total = 0;
+  std::string name;
+  size_t size;
+  for (std::string line; std::getline(sections, line);) {
+    std::istringstream fields(line);
+    if (!(fields >> name >> size)) {
+      continue;
+    }
+    if (name.rfind(".text", 0) == 0 ||
+        name.rfind(".rodata", 0) == 0 ||
+        name.rfind(".data.rel.ro", 0) == 0) {
+      total += size;
+    }
+  }
+  return total;
+}
+
+struct Shape {
+  size_t indirect_branches = 0;
+  size_t conditional_branches = 0;
+};
+
+Shape dispatch_shape(const std::string& object_path) {
+  std::istringstream disassembly(
+      run_command("objdump -d --no-show-raw-insn " + object_path));
+  Shape shape;
+  for (std::string line; std::getline(disassembly, line);) {
+    size_t tab = line.find('\t');
+    if (tab == std::string::npos) {
+      continue;
+    }
+    std::istringstream instruction(line.substr(tab + 1));
+    std::string mnemonic, operand;
+    instruction >> mnemonic >> operand;
+    bool is_branch = mnemonic[0] == 'j' || mnemonic == "call";
+    if (is_branch && !operand.empty() && operand[0] == '*') {
+      ++shape.indirect_branches;
+    }
+    else if (mnemonic[0] == 'j' && mnemonic != "jmp") {
+      ++shape.conditional_branches;
+    }
+  }
+  return shape;
+}
+}
+
+int main(int argc, char *argv[])
+{
+  std::string baseline_path, write_baseline_path;
+  double tolerance_percent = 10;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    if (flag == "--baseline") {
+      baseline_path = argv[i + 1];
+    }
+    else if (flag == "--write-baseline") {
+      write_baseline_path = argv[i + 1];
+    }
+    else if (flag == "--tolerance") {
+      tolerance_percent = std::atof(argv[i + 1]);
+    }
+  }
+
+  std::map<std::string, double> baseline;
+  if (!baseline_path.empty()) {
+    std::ifstream baseline_file(baseline_path);
+    std::string key;
+    size_t num_alternatives;
+    double bytes;
+    while (baseline_file >> key >> num_alternatives >> bytes) {
+      baseline[key + "/" + std::to_string(num_alternatives)] = bytes;
+    }
+  }
+
+  std::ofstream write_baseline;
+  if (!write_baseline_path.empty()) {
+    write_baseline.open(write_baseline_path);
+  }
+
+  std::cout << "strategy\talternatives\tbytes/visitor"
+            << "\tindirect/visitor\tconditional/visitor" << std::endl;
+  bool ok = true;
+  const std::string object_path = "/tmp/variant_ptr_code_size.o";
+  for (const char* strategy : strategies) {
+    for (size_t num_alternatives : { 2, 4, 8, 16, 32 }) {
+      if (!compile(generate_source(strategy, num_alternatives, 0), object_path)) {
+        ok = false;
+        continue;
+      }
+      size_t empty_size = code_size(object_path);
+      Shape empty_shape = dispatch_shape(object_path);
+      if (!compile(generate_source(strategy, num_alternatives, num_visitors),
+                   object_path)) {
+        ok = false;
+        continue;
+      }
+      double bytes = double(code_size(object_path) - empty_size) / num_visitors;
+      Shape shape = dispatch_shape(object_path);
+      std::cout << strategy << "\t" << num_alternatives << "\t" << bytes << "\t"
+                << double(shape.indirect_branches -
+                          empty_shape.indirect_branches) / num_visitors << "\t"
+                << double(shape.conditional_branches -
+                          empty_shape.conditional_branches) / num_visitors;
+
+      auto expected = baseline.find(
+          std::string(strategy) + "/" + std::to_string(num_alternatives));
+      if (expected != baseline.end() &&
+          bytes > expected->second * (1 + tolerance_percent / 100)) {
+        std::cout << "\tREGRESSED (baseline " << expected->second << ")";
+        ok = false;
+      }
+      std::cout << std::endl;
+      if (write_baseline.is_open()) {
+        write_baseline << strategy << " " << num_alternatives << " "
+                       << bytes << "\n";
+      }
+    }
+  }
+  std::remove(object_path.c_str());
+  return ok ? 0 : 1;
+}
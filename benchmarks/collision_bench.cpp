@@ -0,0 +1,359 @@
+// One frame of a 2D collision loop over a mix of four shape types: a
+// sort-and-sweep broad phase over the shapes' bounds, followed by a
+// narrow phase that double dispatches on every candidate pair. It is
+// implemented three ways: with variant_ptr and a symmetric
+// apply_multi_visitor<2>, with the classic virtual double dispatch, and
+// with std::variant and std::visit. The bounds pass and the narrow
+// phase are timed separately.
+//
+// g++ -O2 -std=c++17 -I.. collision_bench.cpp -o collision_bench
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "bench_harness.h"
+#include "variant_ptr.h"
+
+using namespace lius_tools;
+
+namespace {
+constexpr size_t num_shapes = 20000;
+constexpr float world_size = 1000;
+
+struct Vec2 { float x, y; };
+
+Vec2 operator-(Vec2 a, Vec2 b) { return { a.x - b.x, a.y - b.y }; }
+float dot(Vec2 a, Vec2 b) { return a.x * b.x + a.y * b.y; }
+
+float clamp(float x, float lo, float hi) { return std::min(std::max(x, lo), hi); }
+
+struct Bounds { float min_x, max_x, min_y, max_y; };
+
+// Geometry shared by all three implementations
+struct CircleShape { Vec2 center; float radius; };
+struct BoxShape { Vec2 min, max; };
+struct CapsuleShape { Vec2 a, b; float radius; };
+struct PointShape { Vec2 position; };
+
+Bounds bounds_of(const CircleShape& c) {
+  return { c.center.x - c.radius, c.center.x + c.radius,
+           c.center.y - c.radius, c.center.y + c.radius };
+}
+Bounds bounds_of(const BoxShape& b) {
+  return { b.min.x, b.max.x, b.min.y, b.max.y };
+}
+Bounds bounds_of(const CapsuleShape& c) {
+  return { std::min(c.a.x, c.b.x) - c.radius, std::max(c.a.x, c.b.x) + c.radius,
+           std::min(c.a.y, c.b.y) - c.radius, std::max(c.a.y, c.b.y) + c.radius };
+}
+Bounds bounds_of(const PointShape& p) {
+  return { p.position.x, p.position.x, p.position.y, p.position.y };
+}
+
+float distance_squared_to_segment(Vec2 p, Vec2 a, Vec2 b) {
+  Vec2 ab = b - a;
+  float length_squared = dot(ab, ab);
+  float t = length_squared > 0 ? clamp(dot(p - a, ab) / length_squared, 0, 1) : 0;
+  Vec2 closest = { a.x + ab.x * t, a.y + ab.y * t };
+  return dot(p - closest, p - closest);
+}
+
+float distance_squared_to_box(Vec2 p, const BoxShape& b) {
+  Vec2 closest = { clamp(p.x, b.min.x, b.max.x), clamp(p.y, b.min.y, b.max.y) };
+  return dot(p - closest, p - closest);
+}
+
+bool intersects(const CircleShape& a, const CircleShape& b) {
+  float r = a.radius + b.radius;
+  return dot(a.center - b.center, a.center - b.center) <= r * r;
+}
+bool intersects(const CircleShape& a, const BoxShape& b) {
+  return distance_squared_to_box(a.center, b) <= a.radius * a.radius;
+}
+bool intersects(const CircleShape& a, const CapsuleShape& b) {
+  float r = a.radius + b.radius;
+  return distance_squared_to_segment(a.center, b.a, b.b) <= r * r;
+}
+bool intersects(const CircleShape& a, const PointShape& b) {
+  return dot(a.center - b.position, a.center - b.position) <= a.radius * a.radius;
+}
+bool intersects(const BoxShape& a, const BoxShape& b) {
+  return a.min.x <= b.max.x && b.min.x <= a.max.x &&
+         a.min.y <= b.max.y && b.min.y <= a.max.y;
+}
+bool intersects(const BoxShape& a, const CapsuleShape& b) {
+  // Approximated by testing the capsule's end points and midpoint
+  Vec2 mid = { (b.a.x + b.b.x) / 2, (b.a.y + b.b.y) / 2 };
+  float r2 = b.radius * b.radius;
+  return distance_squared_to_box(b.a, a) <= r2 ||
+         distance_squared_to_box(b.b, a) <= r2 ||
+         distance_squared_to_box(mid, a) <= r2;
+}
+bool intersects(const BoxShape& a, const PointShape& b) {
+  return distance_squared_to_box(b.position, a) == 0;
+}
+bool intersects(const CapsuleShape& a, const CapsuleShape& b) {
+  // Approximated by the end points of each against the other segment
+  float r = a.radius + b.radius;
+  return std::min({ distance_squared_to_segment(a.a, b.a, b.b),
+                    distance_squared_to_segment(a.b, b.a, b.b),
+                    distance_squared_to_segment(b.a, a.a, a.b),
+                    distance_squared_to_segment(b.b, a.a, a.b) }) <= r * r;
+}
+bool intersects(const CapsuleShape& a, const PointShape& b) {
+  return distance_squared_to_segment(b.position, a.a, a.b) <= a.radius * a.radius;
+}
+bool intersects(const PointShape& a, const PointShape& b) {
+  return a.position.x == b.position.x && a.position.y == b.position.y;
+}
+
+using Pairs = std::vector<std::pair<size_t, size_t>>;
+
+// Sort and sweep over x, testing y overlap, on shapes' bounds
+Pairs broad_phase(const std::vector<Bounds>& bounds) {
+  std::vector<size_t> order(bounds.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return bounds[a].min_x < bounds[b].min_x;
+  });
+  Pairs pairs;
+  for (size_t i = 0; i < order.size(); ++i) {
+    const Bounds& a = bounds[order[i]];
+    for (size_t j = i + 1; j < order.size() && bounds[order[j]].min_x <= a.max_x; ++j) {
+      const Bounds& b = bounds[order[j]];
+      if (a.min_y <= b.max_y && b.min_y <= a.max_y) {
+        pairs.emplace_back(order[i], order[j]);
+      }
+    }
+  }
+  return pairs;
+}
+
+// variant_ptr implementation
+namespace vp {
+using ShapePtr = variant_ptr<const CircleShape, const BoxShape,
+                             const CapsuleShape, const PointShape>;
+
+struct GetBounds {
+  template <typename TShape>
+  Bounds visit(const TShape& shape) const { return bounds_of(shape); }
+};
+
+// Only the upper triangle, in type list order, needs to be handled
+struct Intersects {
+  static constexpr bool symmetric = true;
+
+  template <typename A, typename B>
+  bool visit(const A& a, const B& b) const { return intersects(a, b); }
+};
+
+void compute_bounds(const std::vector<ShapePtr>& shapes, Bounds* bounds) {
+  for (const ShapePtr& shape : shapes) {
+    *bounds++ = shape.visit(GetBounds{});
+  }
+}
+
+size_t narrow_phase(const std::vector<ShapePtr>& shapes, const Pairs& pairs) {
+  size_t contacts = 0;
+  Intersects intersects_visitor;
+  for (const auto& pair : pairs) {
+    contacts += apply_multi_visitor<2>(
+        intersects_visitor, shapes[pair.first], shapes[pair.second]);
+  }
+  return contacts;
+}
+}
+
+// Virtual double dispatch implementation
+namespace virt {
+struct Circle;
+struct Box;
+struct Capsule;
+struct Point;
+
+struct Shape {
+  virtual ~Shape() = default;
+  virtual Bounds bounds() const = 0;
+  virtual bool intersects(const Shape& other) const = 0;
+  virtual bool intersects_with(const Circle& other) const = 0;
+  virtual bool intersects_with(const Box& other) const = 0;
+  virtual bool intersects_with(const Capsule& other) const = 0;
+  virtual bool intersects_with(const Point& other) const = 0;
+};
+
+template <typename TDerived, typename TGeometry>
+struct ShapeImpl : Shape {
+  TGeometry geometry;
+  explicit ShapeImpl(const TGeometry& g) : geometry(g) {}
+
+  Bounds bounds() const override { return bounds_of(geometry); }
+  bool intersects(const Shape& other) const override {
+    return other.intersects_with(static_cast<const TDerived&>(*this));
+  }
+  bool intersects_with(const Circle& other) const override;
+  bool intersects_with(const Box& other) const override;
+  bool intersects_with(const Capsule& other) const override;
+  bool intersects_with(const Point& other) const override;
+};
+
+struct Circle : ShapeImpl<Circle, CircleShape> { using ShapeImpl::ShapeImpl; };
+struct Box : ShapeImpl<Box, BoxShape> { using ShapeImpl::ShapeImpl; };
+struct Capsule : ShapeImpl<Capsule, CapsuleShape> { using ShapeImpl::ShapeImpl; };
+struct Point : ShapeImpl<Point, PointShape> { using ShapeImpl::ShapeImpl; };
+
+// Geometry tests are only written for one argument order
+template <typename A, typename B>
+auto ordered_intersects(const A& a, const B& b) -> decltype(intersects(a, b)) {
+  return ::intersects(a, b);
+}
+template <typename A, typename B>
+auto ordered_intersects(const A& a, const B& b) -> decltype(intersects(b, a)) {
+  return ::intersects(b, a);
+}
+bool ordered_intersects(const CircleShape& a, const CircleShape& b) { return intersects(a, b); }
+bool ordered_intersects(const BoxShape& a, const BoxShape& b) { return intersects(a, b); }
+bool ordered_intersects(const CapsuleShape& a, const CapsuleShape& b) { return intersects(a, b); }
+bool ordered_intersects(const PointShape& a, const PointShape& b) { return intersects(a, b); }
+
+template <typename TDerived, typename TGeometry>
+bool ShapeImpl<TDerived, TGeometry>::intersects_with(const Circle& other) const {
+  return ordered_intersects(geometry, other.geometry);
+}
+template <typename TDerived, typename TGeometry>
+bool ShapeImpl<TDerived, TGeometry>::intersects_with(const Box& other) const {
+  return ordered_intersects(geometry, other.geometry);
+}
+template <typename TDerived, typename TGeometry>
+bool ShapeImpl<TDerived, TGeometry>::intersects_with(const Capsule& other) const {
+  return ordered_intersects(geometry, other.geometry);
+}
+template <typename TDerived, typename TGeometry>
+bool ShapeImpl<TDerived, TGeometry>::intersects_with(const Point& other) const {
+  return ordered_intersects(geometry, other.geometry);
+}
+
+void compute_bounds(const std::vector<const Shape*>& shapes, Bounds* bounds) {
+  for (const Shape* shape : shapes) {
+    *bounds++ = shape->bounds();
+  }
+}
+
+size_t narrow_phase(const std::vector<const Shape*>& shapes, const Pairs& pairs) {
+  size_t contacts = 0;
+  for (const auto& pair : pairs) {
+    contacts += shapes[pair.first]->intersects(*shapes[pair.second]);
+  }
+  return contacts;
+}
+}
+
+// std::variant implementation
+namespace stdv {
+using Shape = std::variant<CircleShape, BoxShape, CapsuleShape, PointShape>;
+
+struct Intersects {
+  template <typename A, typename B>
+  bool operator()(const A& a, const B& b) const {
+    return virt::ordered_intersects(a, b);
+  }
+};
+
+void compute_bounds(const std::vector<const Shape*>& shapes, Bounds* bounds) {
+  for (const Shape* shape : shapes) {
+    *bounds++ = std::visit([](const auto& s) { return bounds_of(s); }, *shape);
+  }
+}
+
+size_t narrow_phase(const std::vector<const Shape*>& shapes, const Pairs& pairs) {
+  size_t contacts = 0;
+  for (const auto& pair : pairs) {
+    contacts += std::visit(Intersects{}, *shapes[pair.first], *shapes[pair.second]);
+  }
+  return contacts;
+}
+}
+
+// The same random scene in every representation
+std::vector<stdv::Shape> random_scene() {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> position(0, world_size);
+  std::uniform_real_distribution<float> extent(0.5f, 6);
+  std::uniform_int_distribution<int> kind(0, 3);
+  std::vector<stdv::Shape> scene;
+  for (size_t i = 0; i < num_shapes; ++i) {
+    Vec2 p = { position(rng), position(rng) };
+    switch (kind(rng)) {
+      case 0: scene.emplace_back(CircleShape{ p, extent(rng) }); break;
+      case 1: scene.emplace_back(BoxShape{ p, { p.x + extent(rng), p.y + extent(rng) } }); break;
+      case 2: scene.emplace_back(CapsuleShape{ p, { p.x + extent(rng), p.y - extent(rng) },
+                                               extent(rng) / 4 }); break;
+      default: scene.emplace_back(PointShape{ p }); break;
+    }
+  }
+  return scene;
+}
+
+// Times the two dispatching phases of a frame: computing every shape's
+// bounds for the broad phase, and testing every candidate pair found by
+// the broad phase in the narrow phase.
+template <typename TShapes, typename TComputeBounds, typename TNarrowPhase>
+size_t run_case(bench::harness& harness, const std::string& name,
+                const TShapes& shapes, TComputeBounds compute_bounds,
+                TNarrowPhase narrow_phase) {
+  std::vector<Bounds> bounds(shapes.size());
+  harness.run(name + ", bounds", shapes.size(), [&]() {
+    compute_bounds(shapes, bounds.data());
+    bench::do_not_optimize(bounds.back());
+  });
+  Pairs pairs = broad_phase(bounds);
+  harness.run(name + ", narrow phase", pairs.size(), [&]() {
+    bench::do_not_optimize(narrow_phase(shapes, pairs));
+  });
+  return narrow_phase(shapes, pairs);
+}
+}
+
+int main(int argc, char *argv[])
+{
+  bench::harness harness(argc, argv);
+  std::vector<stdv::Shape> scene = random_scene();
+
+  std::vector<vp::ShapePtr> vp_shapes;
+  std::vector<std::unique_ptr<virt::Shape>> virt_owned;
+  std::vector<const virt::Shape*> virt_shapes;
+  std::vector<const stdv::Shape*> stdv_shapes;
+  for (const stdv::Shape& shape : scene) {
+    stdv_shapes.push_back(&shape);
+    std::visit([&](const auto& s) { vp_shapes.emplace_back(&s); }, shape);
+    switch (shape.index()) {
+      case 0: virt_owned.emplace_back(new virt::Circle(std::get<0>(shape))); break;
+      case 1: virt_owned.emplace_back(new virt::Box(std::get<1>(shape))); break;
+      case 2: virt_owned.emplace_back(new virt::Capsule(std::get<2>(shape))); break;
+      default: virt_owned.emplace_back(new virt::Point(std::get<3>(shape))); break;
+    }
+    virt_shapes.push_back(virt_owned.back().get());
+  }
+
+  size_t vp_contacts = run_case(harness, "variant_ptr (symmetric)", vp_shapes,
+                                vp::compute_bounds, vp::narrow_phase);
+  size_t virt_contacts = run_case(harness, "virtual double dispatch", virt_shapes,
+                                  virt::compute_bounds, virt::narrow_phase);
+  size_t stdv_contacts = run_case(harness, "std::variant", stdv_shapes,
+                                  stdv::compute_bounds, stdv::narrow_phase);
+
+  std::cout << "contacts per frame: " << vp_contacts << std::endl;
+  if (vp_contacts != virt_contacts || vp_contacts != stdv_contacts) {
+    std::cout << "Contact counts differ: " << vp_contacts << " "
+              << virt_contacts << " " << stdv_contacts << std::endl;
+    return 1;
+  }
+  return 0;
+}
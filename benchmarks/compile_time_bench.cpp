@@ -0,0 +1,126 @@
+// Records how long the compiler takes, and how much memory it uses, to
+// compile variant_ptr visitation as the number of alternatives grows.
+//
+// For each alternative count, a translation unit is generated with a
+// variant_ptr over that many types, a single visit, has_type, and an
+// apply_multi_visitor<2> against a second, 4-alternative variant. It is
+// then compiled with $CXX (default c++) and its $CXXFLAGS.
+//
+// g++ -O2 -std=c++17 compile_time_bench.cpp -o compile_time_bench
+// ./compile_time_bench 8 32 128 256
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+std::string source_dir() {
+  std::string file = __FILE__;
+  size_t slash = file.find_last_of('/');
+  return slash == std::string::npos ? "." : file.substr(0, slash);
+}
+
+std::string generate_source(size_t num_alternatives) {
+  std::ostringstream source;
+  source << "#include \"variant_ptr.h\"\n"
+         << "using namespace lius_tools;\n";
+  for (size_t i = 0; i < num_alternatives; ++i) {
+    source << "struct A" << i << " { int value = " << i << "; };\n";
+  }
+  source << "struct B0 {}; struct B1 {}; struct B2 {}; struct B3 {};\n";
+  source << "using APtr = variant_ptr<";
+  for (size_t i = 0; i < num_alternatives; ++i) {
+    source << (i ? ", " : "") << "A" << i;
+  }
+  source << ">;\n"
+         << "using BPtr = variant_ptr<B0, B1, B2, B3>;\n"
+         << "struct Value {\n"
+         << "  template <typename A> int visit(A& a) { return a.value; }\n"
+         << "};\n"
+         << "struct Pair {\n"
+         << "  template <typename A, typename B>\n"
+         << "  int visit(A& a, B&) { return a.value + sizeof(B); }\n"
+         << "};\n"
+         << "int run(APtr a, BPtr b) {\n"
+         << "  Value value;\n"
+         << "  Pair pair;\n"
+         << "  return a.visit(value) + a.has_type<A0>() +\n"
+         << "      apply_multi_visitor<2>(pair, a, b);\n"
+         << "}\n";
+  return source.str();
+}
+
+struct CompileResult {
+  bool ok;
+  double seconds;
+  long max_rss_kb;
+};
+
+CompileResult compile(const std::string& source_path) {
+  const char* cxx = std::getenv("CXX");
+  const char* cxxflags = std::getenv("CXXFLAGS");
+  std::vector<std::string> args = {
+    cxx ? cxx : "c++", "-std=c++17", "-O2", "-c", source_path,
+    "-o", "/dev/null", "-I" + source_dir() + "/.." };
+  if (cxxflags) {
+    std::istringstream flags(cxxflags);
+    for (std::string flag; flags >> flag;) {
+      args.push_back(flag);
+    }
+  }
+  std::vector<char*> argv;
+  for (std::string& arg : args) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  int status = 0;
+  struct rusage usage = {};
+  wait4(pid, &status, 0, &usage);
+  auto stop = std::chrono::steady_clock::now();
+  return { pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+           std::chrono::duration<double>(stop - start).count(),
+           usage.ru_maxrss };
+}
+}
+
+int main(int argc, char *argv[])
+{
+  std::vector<size_t> counts;
+  for (int i = 1; i < argc; ++i) {
+    counts.push_back(std::strtoul(argv[i], nullptr, 10));
+  }
+  if (counts.empty()) {
+    counts = { 4, 16, 64, 128, 256 };
+  }
+
+  std::cout << "alternatives\tseconds\tmax_rss_mb\tstatus" << std::endl;
+  bool all_ok = true;
+  for (size_t num_alternatives : counts) {
+    std::string source_path =
+        "/tmp/variant_ptr_compile_time_" + std::to_string(num_alternatives) + ".cpp";
+    std::ofstream(source_path) << generate_source(num_alternatives);
+    CompileResult result = compile(source_path);
+    std::cout << num_alternatives << "\t"
+              << result.seconds << "\t"
+              << result.max_rss_kb / 1024.0 << "\t"
+              << (result.ok ? "ok" : "FAILED") << std::endl;
+    all_ok = all_ok && result.ok;
+    std::remove(source_path.c_str());
+  }
+  return all_ok ? 0 : 1;
+}
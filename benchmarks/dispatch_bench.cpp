@@ -0,0 +1,122 @@
+// Measures the cost of a single dispatch through visit and through each
+// apply_multi_visitor mode, over a random sequence of alternatives so
+// that the branch predictors cannot learn the pattern.
+//
+// g++ -O2 -std=c++17 -I.. dispatch_bench.cpp -o dispatch_bench
+// ./dispatch_bench --perf
+
+#include <random>
+#include <tuple>
+#include <vector>
+#include "bench_harness.h"
+#include "variant_ptr.h"
+
+using namespace lius_tools;
+
+template <int I>
+struct Alternative {
+  int value = I;
+};
+
+using APtr = variant_ptr<Alternative<0>, Alternative<1>, Alternative<2>,
+                         Alternative<3>, Alternative<4>, Alternative<5>,
+                         Alternative<6>, Alternative<7>>;
+
+struct Value {
+  template <int I>
+  int visit(const Alternative<I>& a) const { return a.value * (I + 1); }
+};
+
+struct Combine {
+  template <int I, int J>
+  int visit(const Alternative<I>& a, const Alternative<J>& b) const {
+    return a.value * (J + 1) - b.value;
+  }
+};
+
+struct SymmetricCombine {
+  static constexpr bool symmetric = true;
+
+  template <int I, int J>
+  int visit(const Alternative<I>& a, const Alternative<J>& b) const {
+    return a.value * (J + 1) + b.value;
+  }
+};
+
+struct SparseCombine {
+  using sparse_cases = case_list<
+    sparse_case<Alternative<0>, Alternative<1>>,
+    sparse_case<Alternative<2>, Alternative<2>>,
+    sparse_case<Alternative<5>, Alternative<7>>>;
+
+  template <int I, int J>
+  int visit(const Alternative<I>& a, const Alternative<J>& b) const {
+    return a.value + b.value;
+  }
+
+  int visit_default(const APtr& a, const APtr& b) const {
+    return int(a.type_index() - b.type_index());
+  }
+};
+
+struct TypeOnlyCombine {
+  static constexpr bool type_only = true;
+
+  template <int I, int J>
+  constexpr int visit(Alternative<I>, Alternative<J>) const {
+    return I * 8 + J;
+  }
+};
+
+constexpr size_t num_elements = 1 << 16;
+
+template <int... Is>
+std::vector<APtr> make_elements(std::tuple<Alternative<Is>...>& objects) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> pick(0, 7);
+  APtr choices[] = { APtr(&std::get<Is>(objects))... };
+  std::vector<APtr> elements;
+  for (size_t i = 0; i < num_elements; ++i) {
+    elements.push_back(choices[pick(rng)]);
+  }
+  return elements;
+}
+
+template <typename TVisitor>
+void run_pairs(bench::harness& harness, const char* name,
+               const std::vector<APtr>& as, const std::vector<APtr>& bs) {
+  harness.run(name, as.size(), [&]() {
+    TVisitor visitor;
+    int sum = 0;
+    for (size_t i = 0; i < as.size(); ++i) {
+      sum += apply_multi_visitor<2>(visitor, as[i], bs[i]);
+    }
+    bench::do_not_optimize(sum);
+  });
+}
+
+int main(int argc, char *argv[])
+{
+  bench::harness harness(argc, argv);
+
+  std::tuple<Alternative<0>, Alternative<1>, Alternative<2>, Alternative<3>,
+             Alternative<4>, Alternative<5>, Alternative<6>, Alternative<7>>
+      objects;
+  std::vector<APtr> as = make_elements(objects);
+  std::vector<APtr> bs(as.rbegin(), as.rend());
+
+  harness.run("visit", as.size(), [&]() {
+    Value value;
+    int sum = 0;
+    for (const APtr& a : as) {
+      sum += a.visit(value);
+    }
+    bench::do_not_optimize(sum);
+  });
+
+  run_pairs<Combine>(harness, "apply_multi_visitor<2> dense", as, bs);
+  run_pairs<SymmetricCombine>(harness, "apply_multi_visitor<2> symmetric", as, bs);
+  run_pairs<SparseCombine>(harness, "apply_multi_visitor<2> sparse", as, bs);
+  run_pairs<TypeOnlyCombine>(harness, "apply_multi_visitor<2> type_only", as, bs);
+  return 0;
+}
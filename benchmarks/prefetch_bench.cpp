@@ -0,0 +1,90 @@
+// Compares range visitation with and without software prefetching,
+// over pointees that live in per-type arenas versus pointees that are
+// scattered across the heap.
+//
+// g++ -O2 -std=c++17 -I.. prefetch_bench.cpp -o prefetch_bench
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "bench_harness.h"
+#include "variant_ptr.h"
+
+using namespace lius_tools;
+
+struct Circle { double radius; char padding[56]; };
+struct Square { double side; char padding[56]; };
+struct Triangle { double base, height; char padding[48]; };
+
+using ShapePtr = variant_ptr<Circle, Square, Triangle>;
+
+struct Area {
+  double total = 0;
+  void visit(const Circle& c) { total += 3.14159 * c.radius * c.radius; }
+  void visit(const Square& s) { total += s.side * s.side; }
+  void visit(const Triangle& t) { total += 0.5 * t.base * t.height; }
+};
+
+constexpr size_t num_shapes = 1 << 21;
+
+template <size_t prefetch_distance>
+void run_case(bench::harness& harness, const std::string& name,
+              const std::vector<ShapePtr>& shapes) {
+  harness.run(name + ", distance " + std::to_string(prefetch_distance),
+              shapes.size(), [&shapes]() {
+                Area area;
+                for_each_visit<prefetch_distance>(shapes, area);
+                bench::do_not_optimize(area.total);
+              });
+}
+
+template <size_t... distances>
+void run_cases(bench::harness& harness, const std::string& name,
+               const std::vector<ShapePtr>& shapes) {
+  (run_case<distances>(harness, name, shapes), ...);
+}
+
+int main(int argc, char *argv[])
+{
+  bench::harness harness(argc, argv);
+  std::mt19937 rng(1234);
+
+  // Arena-backed: each alternative lives in its own contiguous array
+  std::vector<Circle> circles(num_shapes / 3 + 1);
+  std::vector<Square> squares(num_shapes / 3 + 1);
+  std::vector<Triangle> triangles(num_shapes / 3 + 1);
+  std::vector<ShapePtr> arena_shapes;
+  arena_shapes.reserve(num_shapes);
+  for (size_t i = 0; i < num_shapes; ++i) {
+    switch (i % 3) {
+      case 0: circles[i / 3].radius = 1; arena_shapes.emplace_back(&circles[i / 3]); break;
+      case 1: squares[i / 3].side = 1; arena_shapes.emplace_back(&squares[i / 3]); break;
+      default: triangles[i / 3].base = 1; triangles[i / 3].height = 1;
+        arena_shapes.emplace_back(&triangles[i / 3]); break;
+    }
+  }
+
+  // Scattered: individually allocated, then visited in a random order
+  std::vector<std::unique_ptr<Circle>> owned_circles;
+  std::vector<std::unique_ptr<Square>> owned_squares;
+  std::vector<std::unique_ptr<Triangle>> owned_triangles;
+  std::vector<ShapePtr> scattered_shapes;
+  scattered_shapes.reserve(num_shapes);
+  for (size_t i = 0; i < num_shapes; ++i) {
+    switch (i % 3) {
+      case 0: owned_circles.emplace_back(new Circle{1, {}});
+        scattered_shapes.emplace_back(owned_circles.back().get()); break;
+      case 1: owned_squares.emplace_back(new Square{1, {}});
+        scattered_shapes.emplace_back(owned_squares.back().get()); break;
+      default: owned_triangles.emplace_back(new Triangle{1, 1, {}});
+        scattered_shapes.emplace_back(owned_triangles.back().get()); break;
+    }
+  }
+  std::shuffle(scattered_shapes.begin(), scattered_shapes.end(), rng);
+
+  run_cases<0, 4, 8, 16, 32>(harness, "arena", arena_shapes);
+  run_cases<0, 4, 8, 16, 32>(harness, "scattered", scattered_shapes);
+  return 0;
+}
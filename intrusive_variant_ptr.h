@@ -0,0 +1,196 @@
+#ifndef _LIUS_TOOLS_INTRUSIVE_VARIANT_PTR_H_
+#define _LIUS_TOOLS_INTRUSIVE_VARIANT_PTR_H_
+
+#include <cstddef>
+#include <type_traits>
+
+#include "variant_ptr.h"
+
+namespace lius_tools {
+
+// Intrusive type tags:
+//
+// Class hierarchies with LLVM style RTTI already store their kind in
+// the objects themselves:
+//
+// struct Shape { enum Kind { kCircle, kBox } kind; };
+// struct Circle : Shape { ... };
+// struct Box : Shape { ... };
+//
+// A variant_ptr would store that information a second time. An
+// intrusive_variant_ptr stores only a pointer to the common base, and
+// reads the type index from the pointee through a tag policy:
+//
+// using ShapePtr = intrusive_variant_ptr<
+//   member_tag<Shape, &Shape::kind>, Circle, Box>;
+//
+// A tag policy names the common base (base_type) and returns the
+// position of an object's type inside Ts... from a const base_type&
+// (type_index). The tag must match that position exactly: kCircle must
+// be 0 and kBox 1 above.
+//
+// intrusive_variant_ptr has the same visit / visit_tagged / has_type /
+// type_index / get interface as variant_ptr, so it works with
+// apply_multi_visitor, bind_first and the range functions. The range
+// functions prefetch its base, so that prefetching does not read the
+// tag ahead of time.
+
+// Reads the tag from a data member of TBase
+template <typename TBase, auto member>
+struct member_tag {
+  using base_type = TBase;
+
+  static size_t type_index(const TBase& base) {
+    return size_t(base.*member);
+  }
+};
+
+// Reads the tag through a free function taking a const TBase&
+template <typename TBase, auto function>
+struct function_tag {
+  using base_type = TBase;
+
+  static size_t type_index(const TBase& base) {
+    return size_t(function(base));
+  }
+};
+
+namespace {
+// Like visit_dispatch, but starting from a pointer to the common base,
+// so that alternatives whose base is not at offset 0 work too
+template <typename TBase, typename... Ts>
+struct intrusive_dispatch {
+  template <typename U>
+  static void* to_derived(TBase* base) {
+    return const_cast<void*>(static_cast<const volatile void*>(
+        static_cast<U*>(base)));
+  }
+
+  static void* get(size_t index, TBase* base) {
+    static constexpr void* (*table[])(TBase*) = { &to_derived<Ts>... };
+    return table[index](base);
+  }
+
+  template <typename U, typename R, typename TVisitor, typename... TExtras>
+  static R cast_and_visit(TBase* base, TVisitor& visitor, TExtras&... extras) {
+    return visitor.visit(*static_cast<U*>(base), extras...);
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  static typename visit_dispatch<Ts...>::template result_type<
+    TVisitor, TExtras...>
+  visit(size_t index, TBase* base, TVisitor& visitor, TExtras&... extras) {
+    using R = typename visit_dispatch<Ts...>::template result_type<
+      TVisitor, TExtras...>;
+    static constexpr R (*table[])(TBase*, TVisitor&, TExtras&...) = {
+      &cast_and_visit<Ts, R, TVisitor, TExtras...>... };
+    return table[index](base, visitor, extras...);
+  }
+
+  template <typename U, typename R, typename TVisitor, typename... TExtras>
+  static R cast_and_visit_tagged(
+      TBase* base, TVisitor& visitor, TExtras&... extras) {
+    return visit_dispatch<Ts...>::template cast_and_visit_tagged<U, R>(
+        to_derived<U>(base), visitor, extras...);
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  static typename visit_dispatch<Ts...>::template tagged_result_type<
+    TVisitor, TExtras...>
+  visit_tagged(size_t index, TBase* base, TVisitor& visitor,
+               TExtras&... extras) {
+    using R = typename visit_dispatch<Ts...>::template tagged_result_type<
+      TVisitor, TExtras...>;
+    static constexpr R (*table[])(TBase*, TVisitor&, TExtras&...) = {
+      &cast_and_visit_tagged<Ts, R, TVisitor, TExtras...>... };
+    return table[index](base, visitor, extras...);
+  }
+};
+}
+
+template <typename TTag, typename... Ts>
+class intrusive_variant_ptr {
+ public:
+  using base_type = typename std::remove_const<typename TTag::base_type>::type;
+
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  static_assert((std::is_base_of<base_type,
+                                 typename std::remove_const<Ts>::type>::value
+                 && ...),
+                "every alternative must derive from the tag's base_type");
+
+  // The alternative at position I of Ts...
+  template <size_t I>
+  using type = type_at<I, Ts...>;
+
+  template <typename X>
+  intrusive_variant_ptr(X* ptr) {
+    reset(ptr);
+  }
+
+  template <typename X>
+  void reset(X* ptr) {
+    static_assert(index_of_type<X, Ts...>::value != size_t(-1),
+                  "X is not one of the alternatives of this "
+                  "intrusive_variant_ptr");
+    ptr_ = const_cast<base_type*>(static_cast<const base_type*>(ptr));
+  }
+
+  // Position of X inside Ts...
+  template <typename X>
+  static constexpr size_t index_of() {
+    return index_of_type<X, Ts...>::value;
+  }
+
+  template <typename X>
+  bool has_type() const {
+    constexpr bool is_x[] = { std::is_same<X, Ts>::value... };
+    return is_x[type_index()];
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  decltype(auto) visit(
+      TVisitor&& visitor, TExtras&&... extras) const {
+    return intrusive_dispatch<base_type, Ts...>::visit(
+        type_index(), ptr_, visitor, extras...);
+  }
+
+  // Returns the visitor's result as a std::variant over the distinct
+  // return types of its overloads, like variant_ptr::visit_tagged
+  template <typename TVisitor, typename... TExtras>
+  auto visit_tagged(
+      TVisitor&& visitor, TExtras&&... extras) const {
+    return intrusive_dispatch<base_type, Ts...>::visit_tagged(
+        type_index(), ptr_, visitor, extras...);
+  }
+
+  // The pointee, as a pointer to its own type. Reads the tag from the
+  // pointee.
+  void* get() const {
+    return intrusive_dispatch<base_type, Ts...>::get(type_index(), ptr_);
+  }
+
+  // The pointee, as a pointer to the common base
+  base_type* base() const {
+    return ptr_;
+  }
+
+  // What the range functions prefetch: the base, whose address does
+  // not depend on the tag, unlike get()
+  const void* prefetch_address() const {
+    return ptr_;
+  }
+
+  // Position of the pointee's type inside Ts..., read from the pointee
+  size_t type_index() const {
+    return TTag::type_index(*ptr_);
+  }
+
+ private:
+  base_type* ptr_;
+};
+
+}
+
+#endif /* _LIUS_TOOLS_INTRUSIVE_VARIANT_PTR_H_ */
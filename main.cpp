@@ -21,20 +21,24 @@ struct GetDescription {
 };
 
 struct LosesTo {
-  static bool visit(Rock rock, Paper paper) {
+  // The result only depends on the types of the hands, so
+  // apply_multi_visitor can precompute it for every pair
+  static constexpr bool type_only = true;
+
+  static constexpr bool visit(Rock rock, Paper paper) {
     return true;
   }
 
-  static bool visit(Paper paper, Scissors scissors) {
+  static constexpr bool visit(Paper paper, Scissors scissors) {
     return true;
   }
 
-  static bool visit(Scissors scissors, Rock rock) {
+  static constexpr bool visit(Scissors scissors, Rock rock) {
     return true;
   }
 
   template <typename A, typename B>
-  static bool visit(A a, B b) {
+  static constexpr bool visit(A a, B b) {
     return false;
   }
 };
@@ -0,0 +1,139 @@
+#ifndef _LIUS_TOOLS_OFFSET_VARIANT_PTR_H_
+#define _LIUS_TOOLS_OFFSET_VARIANT_PTR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "variant_ptr.h"
+
+namespace lius_tools {
+
+// Self-relative variant pointers:
+//
+// A variant_ptr stores an absolute address, which is meaningless once
+// the memory holding it is mapped somewhere else, e.g. a memory-mapped
+// file or a shared-memory segment that lands at a different address in
+// every process. An offset_variant_ptr instead stores the distance from
+// itself to its pointee, packed into one 64 bit word together with the
+// type index:
+//
+//   bits 63..8: signed byte offset from this to the pointee
+//   bits  7..0: type index
+//
+// As long as the pointer and its pointee move together (they live in
+// the same mapping), the pointer stays valid, so a prebuilt graph can
+// be mapped and traversed right away, without any deserialization:
+//
+// struct Node {
+//   offset_variant_ptr<const Leaf, const Node> left;
+//   offset_variant_ptr<const Leaf, const Node> right;
+// };
+// const Node& root = *reinterpret_cast<const Node*>(mapped_bytes);
+// root.left.visit(my_visitor);
+//
+// It has the same visit / has_type / type_index / get interface as
+// variant_ptr, so it works with apply_multi_visitor, bind_first and the
+// range functions, also mixed with plain variant_ptrs.
+//
+// Copying an offset_variant_ptr recomputes the offset, so that the copy
+// points at the same object as the original. The layout is the same on
+// every platform with 64 bit two's complement integers, but the
+// alternatives themselves must of course have a stable layout too.
+template <typename... Ts>
+class offset_variant_ptr {
+ public:
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  static constexpr size_t tag_bits = 8;
+
+  static_assert(num_types <= (size_t(1) << tag_bits),
+                "offset_variant_ptr supports at most 256 alternatives");
+
+  // The alternative at position I of Ts...
+  template <size_t I>
+  using type = type_at<I, Ts...>;
+
+  template <typename X>
+  offset_variant_ptr(X* ptr) {
+    reset(ptr);
+  }
+
+  offset_variant_ptr(const variant_ptr<Ts...>& ptr) {
+    reset_raw(ptr.type_index(), ptr.get());
+  }
+
+  offset_variant_ptr(const offset_variant_ptr& other) {
+    reset_raw(other.type_index(), other.get());
+  }
+
+  offset_variant_ptr& operator=(const offset_variant_ptr& other) {
+    reset_raw(other.type_index(), other.get());
+    return *this;
+  }
+
+  template <typename X>
+  void reset(X* ptr) {
+    static_assert(index_of_type<X, Ts...>::value != size_t(-1),
+                  "X is not one of the alternatives of this offset_variant_ptr");
+    reset_raw(index_of_type<X, Ts...>::value, (void *)(ptr));
+  }
+
+  // Position of X inside Ts...
+  template <typename X>
+  static constexpr size_t index_of() {
+    return index_of_type<X, Ts...>::value;
+  }
+
+  template <typename X>
+  bool has_type() const {
+    constexpr bool is_x[] = { std::is_same<X, Ts>::value... };
+    return is_x[type_index()];
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  decltype(auto) visit(
+      TVisitor&& visitor, TExtras&&... extras) const {
+    return visit_dispatch<Ts...>::visit(
+        type_index(), get(), visitor, extras...);
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  auto visit_tagged(
+      TVisitor&& visitor, TExtras&&... extras) const {
+    return visit_dispatch<Ts...>::visit_tagged(
+        type_index(), get(), visitor, extras...);
+  }
+
+  // The pointee's current address, without any type information
+  void* get() const {
+    // Arithmetic shift keeps the offset's sign
+    std::int64_t offset = static_cast<std::int64_t>(word_) >> tag_bits;
+    return reinterpret_cast<void*>(address() + std::uintptr_t(offset));
+  }
+
+  // Position of the pointee's type inside Ts...
+  size_t type_index() const {
+    return size_t(word_ & ((std::uint64_t(1) << tag_bits) - 1));
+  }
+
+ private:
+  // The offsets are computed on integers: pointer arithmetic between
+  // this and a pointee outside of it is undefined, and optimizers do
+  // fold it as such
+  std::uintptr_t address() const {
+    return reinterpret_cast<std::uintptr_t>(this);
+  }
+
+  void reset_raw(size_t type_index, void* ptr) {
+    std::int64_t offset = static_cast<std::int64_t>(
+        reinterpret_cast<std::uintptr_t>(ptr) - address());
+    word_ = (static_cast<std::uint64_t>(offset) << tag_bits) |
+        std::uint64_t(type_index);
+  }
+
+  std::uint64_t word_;
+};
+
+}
+
+#endif /* _LIUS_TOOLS_OFFSET_VARIANT_PTR_H_ */
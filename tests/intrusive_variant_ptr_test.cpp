@@ -0,0 +1,104 @@
+// Behavior checks for intrusive_variant_ptr.h.
+//
+// g++ -std=c++17 -Wall -Wextra -I.. intrusive_variant_ptr_test.cpp -o intrusive_variant_ptr_test
+
+#include <string>
+#include <vector>
+#include "test_harness.h"
+#include "intrusive_variant_ptr.h"
+
+using namespace lius_tools;
+
+struct Shape {
+  enum Kind { kCircle, kBox } kind;
+};
+
+struct Circle : Shape {
+  double radius;
+  Circle(double r) : Shape { kCircle }, radius(r) {}
+};
+
+// The base is not at offset 0
+struct Named {
+  const char* name = "box";
+};
+
+struct Box : Named, Shape {
+  double side;
+  Box(double s) : Shape { kBox }, side(s) {}
+};
+
+using ShapePtr = intrusive_variant_ptr<
+  member_tag<Shape, &Shape::kind>, Circle, Box>;
+
+// Counts how often the tag is read
+int tag_reads = 0;
+
+size_t counted_kind(const Shape& shape) {
+  ++tag_reads;
+  return shape.kind;
+}
+
+using CountedShapePtr = intrusive_variant_ptr<
+  function_tag<Shape, &counted_kind>, Circle, Box>;
+
+struct Area {
+  double total = 0;
+  void visit(const Circle& circle) { total += 3 * circle.radius; }
+  void visit(const Box& box) { total += box.side * box.side; }
+};
+
+struct Describe {
+  double visit(const Circle& circle) const { return circle.radius; }
+  std::string visit(const Box& box) const { return box.name; }
+};
+
+void test_visit() {
+  Circle circle(2);
+  Box box(3);
+  ShapePtr a = &circle;
+  ShapePtr b = &box;
+  CHECK(a.type_index() == 0);
+  CHECK(b.type_index() == 1);
+  CHECK(b.has_type<Box>());
+  CHECK(b.get() == static_cast<void*>(&box));
+  CHECK(b.base() == static_cast<Shape*>(&box));
+
+  Area area;
+  b.visit(area);
+  CHECK(area.total == 9);
+}
+
+void test_visit_tagged() {
+  Circle circle(2);
+  Box box(3);
+  ShapePtr a = &circle;
+  ShapePtr b = &box;
+  auto tagged_circle = a.visit_tagged(Describe{});
+  auto tagged_box = b.visit_tagged(Describe{});
+  CHECK(std::get<double>(tagged_circle) == 2);
+  CHECK(std::get<std::string>(tagged_box) == "box");
+}
+
+// Prefetching must not read the tags of the elements ahead
+void test_prefetch_reads_no_tags() {
+  std::vector<Circle> circles(20, Circle(1));
+  std::vector<Box> boxes(20, Box(1));
+  std::vector<CountedShapePtr> shapes;
+  for (size_t i = 0; i < circles.size(); ++i) {
+    shapes.push_back(&circles[i]);
+    shapes.push_back(&boxes[i]);
+  }
+  Area area;
+  tag_reads = 0;
+  for_each_visit<4>(shapes, area);
+  CHECK(area.total == 80);
+  CHECK(tag_reads == int(shapes.size()));
+}
+
+int main() {
+  test_visit();
+  test_visit_tagged();
+  test_prefetch_reads_no_tags();
+  return test::exit_code();
+}
@@ -0,0 +1,133 @@
+// Behavior checks for offset_variant_ptr.h.
+//
+// g++ -std=c++17 -Wall -Wextra -I.. offset_variant_ptr_test.cpp -o offset_variant_ptr_test
+
+#include <cstring>
+#include <new>
+#include "test_harness.h"
+#include "offset_variant_ptr.h"
+
+using namespace lius_tools;
+
+struct Leaf { int value; };
+struct Node;
+
+using Edge = offset_variant_ptr<const Leaf, const Node>;
+
+struct Node {
+  Edge left;
+  Edge right;
+
+  template <typename L, typename R>
+  Node(const L* l, const R* r) : left(l), right(r) {}
+};
+
+struct Sum {
+  int visit(const Leaf& leaf) const { return leaf.value; }
+  int visit(const Node& node) const {
+    return node.left.visit(*this) + node.right.visit(*this);
+  }
+};
+
+// The leaves come before the nodes, so every edge points backwards
+// (a negative offset) except root.right, which points forwards
+struct Graph {
+  Leaf leaves[3];
+  Node inner;
+  Node root;
+  Leaf last;
+
+  Graph() :
+      leaves{ { 1 }, { 2 }, { 3 } },
+      inner(&leaves[0], &leaves[1]),
+      root(&inner, &last),
+      last{ 4 } {}
+};
+
+void test_relocated_bytes() {
+  alignas(Graph) unsigned char original[sizeof(Graph)];
+  alignas(Graph) unsigned char mapped[sizeof(Graph)];
+  Graph* graph = new (original) Graph();
+  CHECK(Sum{}.visit(graph->root) == 7);
+
+  // What a file or a shared-memory segment mapped elsewhere would hold
+  std::memcpy(mapped, original, sizeof(Graph));
+  std::memset(original, 0, sizeof(Graph));
+  const Graph& copy = *reinterpret_cast<const Graph*>(mapped);
+  CHECK(Sum{}.visit(copy.root) == 7);
+  CHECK(copy.root.left.get() == &copy.inner);
+  CHECK(copy.root.right.get() == &copy.last);
+  CHECK(copy.inner.left.get() == &copy.leaves[0]);
+  CHECK(copy.root.left.has_type<const Node>());
+  CHECK(copy.inner.right.has_type<const Leaf>());
+}
+
+void test_offset_sign() {
+  Graph graph;
+  CHECK(static_cast<char*>(graph.inner.left.get()) <
+        reinterpret_cast<char*>(&graph.inner.left));
+  CHECK(graph.inner.left.type_index() == 0);
+  CHECK(graph.inner.left.visit(Sum{}) == 1);
+  CHECK(static_cast<char*>(graph.root.right.get()) >
+        reinterpret_cast<char*>(&graph.root.right));
+  CHECK(graph.root.right.type_index() == 0);
+  CHECK(graph.root.right.visit(Sum{}) == 4);
+  CHECK(graph.root.left.type_index() == 1);
+  CHECK(graph.root.left.visit(Sum{}) == 3);
+}
+
+void test_copies() {
+  Graph graph;
+
+  // Copies live elsewhere, yet point at the same object
+  Edge copy = graph.root.left;
+  CHECK(copy.get() == &graph.inner);
+  CHECK(copy.type_index() == 1);
+  CHECK(copy.visit(Sum{}) == 3);
+
+  Edge assigned = &graph.leaves[2];
+  assigned = graph.inner.right;
+  CHECK(assigned.get() == &graph.leaves[1]);
+  CHECK(assigned.type_index() == 0);
+  CHECK(assigned.visit(Sum{}) == 2);
+
+  // Assigning into the graph retargets that edge only
+  graph.root.right = graph.inner.left;
+  CHECK(graph.root.right.get() == &graph.leaves[0]);
+  CHECK(Sum{}.visit(graph.root) == 4);
+
+  Edge from_view = variant_ptr<const Leaf, const Node>(&graph.leaves[2]);
+  CHECK(from_view.get() == &graph.leaves[2]);
+  CHECK(from_view.visit(Sum{}) == 3);
+}
+
+// Multi visitation
+
+struct Pairs {
+  int visit(const Leaf& a, const Leaf& b) const { return a.value * 10 + b.value; }
+  int visit(const Leaf& a, const Node&) const { return a.value * 10; }
+  int visit(const Node&, const Leaf& b) const { return 50 + b.value; }
+  int visit(const Node&, const Node&) const { return 55; }
+};
+
+void test_multi_visit() {
+  Graph graph;
+  using View = variant_ptr<const Leaf, const Node>;
+  View leaf = &graph.leaves[2];
+  View node = &graph.inner;
+
+  CHECK(apply_multi_visitor<2>(Pairs{}, graph.inner.left, leaf) == 13);
+  CHECK(apply_multi_visitor<2>(Pairs{}, graph.root.left, leaf) == 53);
+  CHECK(apply_multi_visitor<2>(Pairs{}, leaf, graph.root.right) == 34);
+  CHECK(apply_multi_visitor<2>(Pairs{}, node, graph.root.left) == 55);
+  CHECK(apply_multi_visitor<2>(Pairs{}, graph.inner.right, graph.root.left) ==
+        20);
+}
+
+int main() {
+  test_relocated_bytes();
+  test_offset_sign();
+  test_copies();
+  test_multi_visit();
+  return test::exit_code();
+}
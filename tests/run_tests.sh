@@ -0,0 +1,25 @@
+#!/bin/sh
+# Builds and runs every *_test.cpp in this directory with warnings as
+# errors and the address and undefined behavior sanitizers.
+#
+# CXX=clang++ ./run_tests.sh
+
+set -e
+
+cd "$(dirname "$0")"
+CXX=${CXX:-g++}
+build_dir=$(mktemp -d)
+trap 'rm -rf "$build_dir"' EXIT
+
+status=0
+for source in *_test.cpp; do
+  name=${source%.cpp}
+  echo "== $name"
+  $CXX -std=c++17 -g -O1 -Wall -Wextra -Werror \
+      -fsanitize=address,undefined -fno-sanitize-recover=undefined \
+      -I.. "$source" -o "$build_dir/$name" -pthread
+  if ! "$build_dir/$name"; then
+    status=1
+  fi
+done
+exit $status
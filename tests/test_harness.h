@@ -0,0 +1,56 @@
+#ifndef _LIUS_TOOLS_TEST_HARNESS_H_
+#define _LIUS_TOOLS_TEST_HARNESS_H_
+
+// Minimal checking harness shared by the test programs.
+//
+// CHECK reports a failed condition with its location and carries on, so
+// one run lists every failure. Each test program returns
+// test::exit_code() from main, which is nonzero if any check failed.
+
+#include <iostream>
+
+namespace test {
+
+inline int& failures() {
+  static int count = 0;
+  return count;
+}
+
+inline void check(bool passed, const char* expression,
+                  const char* file, int line) {
+  if (!passed) {
+    std::cerr << file << ":" << line << ": check failed: "
+              << expression << std::endl;
+    ++failures();
+  }
+}
+
+inline int exit_code() {
+  if (failures() == 0) {
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+  }
+  std::cerr << failures() << " check(s) failed" << std::endl;
+  return 1;
+}
+
+}
+
+#define CHECK(...) \
+  test::check(bool(__VA_ARGS__), #__VA_ARGS__, __FILE__, __LINE__)
+
+// Checks that expression throws an exception of type TException
+#define CHECK_THROWS(TException, ...)                                 \
+  do {                                                                \
+    bool thrown = false;                                              \
+    try {                                                             \
+      (void)(__VA_ARGS__);                                            \
+    }                                                                 \
+    catch (const TException&) {                                       \
+      thrown = true;                                                  \
+    }                                                                 \
+    test::check(thrown, "throws " #TException ": " #__VA_ARGS__,      \
+                __FILE__, __LINE__);                                  \
+  } while (false)
+
+#endif /* _LIUS_TOOLS_TEST_HARNESS_H_ */
@@ -0,0 +1,430 @@
+// Behavior checks for variant_ptr.h.
+//
+// g++ -std=c++17 -Wall -Wextra -I.. variant_ptr_test.cpp -o variant_ptr_test
+
+#include <string>
+#include <typeinfo>
+#include <variant>
+#include <type_traits>
+#include <vector>
+#include "test_harness.h"
+#include "variant_ptr.h"
+
+using namespace lius_tools;
+
+// Return types
+
+// Counts how often it is copied or moved
+struct Big {
+  static int copies;
+  static int moves;
+
+  int value;
+
+  explicit Big(int v) : value(v) {}
+  Big(const Big& other) : value(other.value) { ++copies; }
+  Big(Big&& other) : value(other.value) { ++moves; }
+  Big& operator=(const Big&) = delete;
+  Big& operator=(Big&&) = delete;
+
+  static void reset_counts() {
+    copies = 0;
+    moves = 0;
+  }
+};
+
+int Big::copies = 0;
+int Big::moves = 0;
+
+struct Red { int id; };
+struct Green { int id; };
+
+using ColorPtr = variant_ptr<Red, Green>;
+
+// Returns a reference to a Big it owns
+struct ByReference {
+  Big big { 7 };
+
+  const Big& visit(Red&) { return big; }
+  const Big& visit(Green&) { return big; }
+
+  const Big& visit(Red&, Red&) { return big; }
+  const Big& visit(Red&, Green&) { return big; }
+  const Big& visit(Green&, Red&) { return big; }
+  const Big& visit(Green&, Green&) { return big; }
+};
+
+// Returns a new Big by value
+struct ByValue {
+  Big visit(Red& red) { return Big(red.id); }
+  Big visit(Green& green) { return Big(green.id); }
+
+  Big visit(Red& a, Red& b) { return Big(a.id + b.id); }
+  Big visit(Red& a, Green& b) { return Big(a.id + b.id); }
+  Big visit(Green& a, Red& b) { return Big(a.id + b.id); }
+  Big visit(Green& a, Green& b) { return Big(a.id + b.id); }
+};
+
+struct SymmetricByReference {
+  static constexpr bool symmetric = true;
+
+  Big big { 9 };
+
+  const Big& visit(Red&, Red&) { return big; }
+  const Big& visit(Red&, Green&) { return big; }
+  const Big& visit(Green&, Green&) { return big; }
+};
+
+struct SymmetricByValue {
+  static constexpr bool symmetric = true;
+
+  Big visit(Red& a, Red& b) { return Big(a.id + b.id); }
+  Big visit(Red& a, Green& b) { return Big(a.id + b.id); }
+  Big visit(Green& a, Green& b) { return Big(a.id + b.id); }
+};
+
+void test_return_types() {
+  Red red { 1 };
+  Green green { 2 };
+  ColorPtr a = &red;
+  ColorPtr b = &green;
+
+  ByReference by_reference;
+  static_assert(std::is_same<decltype(a.visit(by_reference)),
+                             const Big&>::value,
+                "visit must return the visitor's reference");
+  static_assert(std::is_same<decltype(apply_multi_visitor<2>(
+                                 by_reference, a, b)),
+                             const Big&>::value,
+                "apply_multi_visitor must return the visitor's reference");
+
+  Big::reset_counts();
+  CHECK(&a.visit(by_reference) == &by_reference.big);
+  CHECK(&apply_multi_visitor<2>(by_reference, a, b) == &by_reference.big);
+  CHECK(&bind_first<ColorPtr>(by_reference, a)(b) == &by_reference.big);
+  CHECK(Big::copies == 0);
+  CHECK(Big::moves == 0);
+
+  ByValue by_value;
+  Big::reset_counts();
+  Big single = a.visit(by_value);
+  Big dense = apply_multi_visitor<2>(by_value, a, b);
+  Big bound = bind_first<ColorPtr>(by_value, b)(a);
+  CHECK(single.value == 1);
+  CHECK(dense.value == 3);
+  CHECK(bound.value == 3);
+  CHECK(Big::copies == 0);
+  CHECK(Big::moves == 0);
+
+  SymmetricByReference symmetric_by_reference;
+  Big::reset_counts();
+  CHECK(&apply_multi_visitor<2>(symmetric_by_reference, b, a) ==
+        &symmetric_by_reference.big);
+  CHECK(Big::copies == 0);
+  CHECK(Big::moves == 0);
+
+  SymmetricByValue symmetric_by_value;
+  Big::reset_counts();
+  Big symmetric = apply_multi_visitor<2>(symmetric_by_value, b, a);
+  CHECK(symmetric.value == 3);
+  CHECK(Big::copies == 0);
+  CHECK(Big::moves == 0);
+}
+
+// Differing return types are unified through std::common_type
+struct Widening {
+  int visit(Red& red) { return red.id; }
+  long visit(Green& green) { return green.id; }
+};
+
+// or returned tagged, when they have none
+struct Describe {
+  int visit(Red& red) { return red.id; }
+  std::string visit(Green&) { return "green"; }
+};
+
+void test_differing_return_types() {
+  Red red { 4 };
+  Green green { 5 };
+  ColorPtr a = &red;
+  ColorPtr b = &green;
+
+  Widening widening;
+  static_assert(std::is_same<decltype(a.visit(widening)), long>::value,
+                "differing results must be unified to their common type");
+  CHECK(a.visit(widening) == 4);
+  CHECK(b.visit(widening) == 5);
+
+  Describe describe;
+  auto tagged_red = a.visit_tagged(describe);
+  auto tagged_green = b.visit_tagged(describe);
+  CHECK(std::get<int>(tagged_red) == 4);
+  CHECK(std::get<std::string>(tagged_green) == "green");
+}
+
+// Multi visitor dispatch modes
+
+struct Rock {};
+struct Paper {};
+struct Scissors {};
+
+using HandPtr = variant_ptr<Rock, Paper, Scissors>;
+
+// Evaluated at compile time into a table; the tests build with -Wextra
+// -Werror, which also covers the library's own code on this path
+struct LosesTo {
+  static constexpr bool type_only = true;
+
+  template <typename A, typename B>
+  constexpr bool visit(A, B) const {
+    return (std::is_same<A, Rock>::value && std::is_same<B, Paper>::value) ||
+        (std::is_same<A, Paper>::value && std::is_same<B, Scissors>::value) ||
+        (std::is_same<A, Scissors>::value && std::is_same<B, Rock>::value);
+  }
+};
+
+void test_type_only() {
+  Rock rock;
+  Paper paper;
+  Scissors scissors;
+  HandPtr hands[] = { &rock, &paper, &scissors };
+  LosesTo loses_to;
+  for (size_t i = 0; i < 3; ++i) {
+    for (size_t j = 0; j < 3; ++j) {
+      CHECK(apply_multi_visitor<2>(loses_to, hands[i], hands[j]) ==
+            ((i + 1) % 3 == j));
+    }
+  }
+}
+
+// Only handles each unordered pair once, as (Ti, Tj) with i <= j
+struct Beats {
+  static constexpr bool symmetric = true;
+
+  std::string visit(Rock&, Rock&) { return "rock rock"; }
+  std::string visit(Rock&, Paper&) { return "rock paper"; }
+  std::string visit(Rock&, Scissors&) { return "rock scissors"; }
+  std::string visit(Paper&, Paper&) { return "paper paper"; }
+  std::string visit(Paper&, Scissors&) { return "paper scissors"; }
+  std::string visit(Scissors&, Scissors&) { return "scissors scissors"; }
+};
+
+void test_symmetric() {
+  Rock rock;
+  Scissors scissors;
+  HandPtr a = &rock;
+  HandPtr b = &scissors;
+  Beats beats;
+  CHECK(apply_multi_visitor<2>(beats, a, b) == "rock scissors");
+  CHECK(apply_multi_visitor<2>(beats, b, a) == "rock scissors");
+  CHECK(bind_first<HandPtr>(beats, a)(b) == "rock scissors");
+  CHECK(bind_first<HandPtr>(beats, b)(a) == "rock scissors");
+  CHECK(bind_first<HandPtr>(beats, b)(b) == "scissors scissors");
+}
+
+// Two listed combinations, everything else goes to visit_default
+struct Ties {
+  using sparse_cases = case_list<
+    sparse_case<Scissors, Rock, Paper>,
+    sparse_case<Rock, Rock, Rock>>;
+
+  int visit(Scissors&, Rock&, Paper&) { return 1; }
+  int visit(Rock&, Rock&, Rock&) { return 2; }
+  int visit_default(const HandPtr& a, const HandPtr& b, const HandPtr& c) {
+    return -int(a.type_index() * 9 + b.type_index() * 3 + c.type_index());
+  }
+};
+
+void test_sparse() {
+  Rock rock;
+  Paper paper;
+  Scissors scissors;
+  HandPtr hands[] = { &rock, &paper, &scissors };
+  Ties ties;
+  for (HandPtr& a : hands) {
+    auto bound = bind_first<HandPtr, HandPtr>(ties, a);
+    for (HandPtr& b : hands) {
+      for (HandPtr& c : hands) {
+        int expected = apply_multi_visitor<3>(ties, a, b, c);
+        CHECK(bound(b, c) == expected);
+      }
+    }
+  }
+  CHECK(apply_multi_visitor<3>(ties, hands[2], hands[0], hands[1]) == 1);
+  CHECK(apply_multi_visitor<3>(ties, hands[0], hands[0], hands[0]) == 2);
+  CHECK(apply_multi_visitor<3>(ties, hands[1], hands[2], hands[0]) == -15);
+  CHECK(bind_first<HandPtr, HandPtr>(ties, hands[2])(hands[0], hands[1]) == 1);
+  CHECK(bind_first<HandPtr, HandPtr>(ties, hands[1])(hands[0], hands[1]) ==
+        -10);
+}
+
+// Polymorphic base pointers
+
+struct Widget {
+  virtual ~Widget() = default;
+};
+
+struct Button : Widget {};
+
+// Derives from another alternative
+struct ImageButton : Button {};
+
+struct Label : Widget {};
+
+struct WidgetKind {
+  std::string visit(Button&) const { return "button"; }
+  std::string visit(ImageButton&) const { return "image button"; }
+};
+
+void test_from_polymorphic() {
+  using WidgetPtr = variant_ptr<Button, ImageButton>;
+  Button button;
+  ImageButton image_button;
+  Label label;
+  Widget* widgets[] = { &image_button, &button, &image_button };
+  const char* kinds[] = { "image button", "button", "image button" };
+  for (size_t i = 0; i < 3; ++i) {
+    WidgetPtr widget = from_polymorphic<WidgetPtr>(widgets[i]);
+    CHECK(widget.get() == static_cast<void*>(widgets[i]));
+    CHECK(widget.visit(WidgetKind{}) == kinds[i]);
+  }
+  CHECK(from_polymorphic<WidgetPtr>(widgets[0]).type_index() == 1);
+  CHECK_THROWS(std::bad_cast,
+               from_polymorphic<WidgetPtr>(static_cast<Widget*>(&label)));
+}
+
+void test_derived_alternative() {
+  using WidgetPtr = variant_ptr<Button, ImageButton>;
+  Button button;
+  ImageButton image_button;
+  WidgetPtr widget(&image_button);
+  CHECK(widget.type_index() == 1);
+  CHECK(widget.visit(WidgetKind{}) == "image button");
+  widget.reset(&button);
+  CHECK(widget.type_index() == 0);
+  CHECK(widget.visit(WidgetKind{}) == "button");
+  widget.reset(&image_button);
+  CHECK(widget.type_index() == 1);
+  CHECK(widget.visit(WidgetKind{}) == "image button");
+
+  // Only a derived type that is not itself an alternative takes the
+  // first base it converts to
+  struct IconButton : ImageButton {} icon_button;
+  widget.reset(&icon_button);
+  CHECK(widget.type_index() == 0);
+  CHECK(widget.visit(WidgetKind{}) == "button");
+}
+
+// Conversions
+
+struct Ant {};
+struct Bee {};
+struct Cat {};
+struct Dog {};
+
+using AntBee = variant_ptr<Ant, Bee>;
+using DogAnt = variant_ptr<Dog, Ant>;
+
+static_assert(std::is_convertible<variant_ptr<Bee>, AntBee>::value,
+              "a subset of the alternatives converts");
+static_assert(std::is_convertible<variant_ptr<Bee, Ant>,
+                                  variant_ptr<const Ant, const Bee>>::value,
+              "reordering and adding const converts");
+static_assert(!std::is_convertible<variant_ptr<Ant, Dog>, AntBee>::value,
+              "a partial overlap does not convert implicitly");
+static_assert(!std::is_convertible<variant_ptr<const Ant>,
+                                   variant_ptr<Ant>>::value,
+              "dropping const does not convert");
+
+// Only the total conversion is viable
+const char* overloaded(AntBee) { return "ant bee"; }
+const char* overloaded(DogAnt) { return "dog ant"; }
+
+void test_conversions() {
+  Ant ant;
+  Bee bee;
+  Dog dog;
+  variant_ptr<Bee, Ant> bee_ant = &bee;
+  variant_ptr<const Ant, const Bee> converted = bee_ant;
+  CHECK(converted.type_index() == 1);
+  CHECK(converted.get() == &bee);
+  bee_ant = &ant;
+  converted = bee_ant;
+  CHECK(converted.type_index() == 0);
+
+  CHECK(std::string(overloaded(variant_ptr<Dog>(&dog))) == "dog ant");
+  CHECK(std::string(overloaded(variant_ptr<Bee>(&bee))) == "ant bee");
+
+  variant_ptr<Cat, Ant, Dog> cat_ant_dog = &ant;
+  AntBee cast = variant_cast<AntBee>(cat_ant_dog);
+  CHECK(cast.type_index() == 0);
+  CHECK(cast.get() == &ant);
+  cat_ant_dog = &dog;
+  CHECK_THROWS(std::bad_cast, variant_cast<AntBee>(cat_ant_dog));
+
+  std::vector<variant_ptr<Bee, Ant>> sources = { &ant, &bee, &bee };
+  std::vector<AntBee> targets(3);
+  auto end = convert_variants<AntBee>(
+      sources.begin(), sources.end(), targets.begin());
+  CHECK(end == targets.end());
+  CHECK(targets[0].type_index() == 0);
+  CHECK(targets[1].type_index() == 1);
+  CHECK(targets[2].get() == &bee);
+}
+
+// std::variant interop
+
+struct Pair {
+  std::string visit(Rock&, Paper&) { return "rock paper"; }
+  std::string visit(Rock&, Scissors&) { return "rock scissors"; }
+  std::string visit(Paper&, Paper&) { return "paper paper"; }
+  std::string visit(Paper&, Scissors&) { return "paper scissors"; }
+  std::string visit(Scissors&, Paper&) { return "scissors paper"; }
+  std::string visit(Scissors&, Scissors&) { return "scissors scissors"; }
+
+  template <typename A, typename B>
+  std::string visit(A&, B&) { return "other"; }
+
+  // Takes a std::variant as a plain extra argument
+  template <typename A, typename B>
+  std::string visit(A& a, B& b, const std::variant<int, std::string>& note) {
+    return visit(a, b) + " " + std::get<std::string>(note);
+  }
+};
+
+void test_std_variant() {
+  std::variant<Rock, Paper, Scissors> held = Paper{};
+  Scissors scissors;
+  std::variant<Rock*, Paper*, Scissors*> pointer = &scissors;
+  Rock rock;
+  HandPtr ptr = &rock;
+  Pair pair;
+
+  CHECK(as_variant_ptr(held).type_index() == 1);
+  CHECK(as_variant_ptr(held).get() == &std::get<Paper>(held));
+  CHECK(as_variant_ptr(pointer).get() == &scissors);
+
+  CHECK(apply_multi_visitor<2>(pair, held, pointer) == "paper scissors");
+  CHECK(apply_multi_visitor<2>(pair, pointer, held) == "scissors paper");
+  CHECK(apply_multi_visitor<2>(pair, ptr, held) == "rock paper");
+  CHECK(apply_multi_visitor<2>(pair, ptr, pointer) == "rock scissors");
+
+  const std::variant<int, std::string> note = std::string("noted");
+  CHECK(apply_multi_visitor<2>(pair, held, ptr, note) == "other noted");
+
+  Beats beats;
+  CHECK(apply_multi_visitor<2>(beats, held, pointer) == "paper scissors");
+}
+
+int main() {
+  test_return_types();
+  test_differing_return_types();
+  test_type_only();
+  test_symmetric();
+  test_sparse();
+  test_from_polymorphic();
+  test_derived_alternative();
+  test_conversions();
+  test_std_variant();
+  return test::exit_code();
+}
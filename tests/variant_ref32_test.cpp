@@ -0,0 +1,86 @@
+// Behavior checks for variant_ref32.h.
+//
+// g++ -std=c++17 -Wall -Wextra -I.. variant_ref32_test.cpp -o variant_ref32_test
+
+#include <memory>
+#include <utility>
+#include "test_harness.h"
+#include "variant_ref32.h"
+
+using namespace lius_tools;
+
+struct Leaf { int value; };
+struct Node { int left, right; };
+
+using Pools = variant_pools<Leaf, Node>;
+using Ref = variant_ref32<Leaf, Node>;
+
+struct Sum {
+  int visit(const Leaf& leaf) const { return leaf.value; }
+  int visit(const Node& node) const { return node.left + node.right; }
+};
+
+void test_references() {
+  static_assert(sizeof(Ref) == 4, "variant_ref32 must stay 32 bits");
+  Pools pools;
+  Ref leaf = pools.emplace<Leaf>(Leaf{ 3 });
+  Ref node = pools.emplace<Node>(Node{ 4, 5 });
+  CHECK(leaf.type_index() == 0);
+  CHECK(node.type_index() == 1);
+  CHECK(leaf.has_type<Leaf>());
+  CHECK(pools.visit(leaf, Sum{}) == 3);
+  CHECK(pools.visit(node, Sum{}) == 9);
+  CHECK(pools.resolve(node).type_index() == 1);
+  CHECK(pools.resolve(node).get() == pools.get(node));
+
+  const Pools& const_pools = pools;
+  variant_ptr<const Leaf, const Node> resolved = const_pools.resolve(node);
+  CHECK(resolved.type_index() == 1);
+  CHECK(resolved.visit(Sum{}) == 9);
+}
+
+void test_references_survive_growth() {
+  Pools pools;
+  Ref first = pools.emplace<Leaf>(Leaf{ 1 });
+  for (int i = 0; i < 1000; ++i) {
+    pools.emplace<Leaf>(Leaf{ i });
+  }
+  CHECK(pools.visit(first, Sum{}) == 1);
+  CHECK(pools.pool<Leaf>().size() == 1001);
+}
+
+void test_reserve() {
+  Pools pools;
+  Ref leaf = pools.emplace<Leaf>(Leaf{ 6 });
+  pools.reserve<Leaf>(1000);
+  CHECK(pools.get(leaf) == &pools.pool<Leaf>()[0]);
+  CHECK(pools.visit(leaf, Sum{}) == 6);
+}
+
+void test_copies() {
+  Ref leaf(0, 0);
+  std::unique_ptr<Pools> source(new Pools);
+  leaf = source->emplace<Leaf>(Leaf{ 7 });
+  Pools copy(*source);
+  Pools assigned;
+  assigned.emplace<Node>(Node{ 1, 2 });
+  assigned = *source;
+  source.reset();
+  CHECK(copy.get(leaf) == &copy.pool<Leaf>()[0]);
+  CHECK(copy.visit(leaf, Sum{}) == 7);
+  CHECK(assigned.get(leaf) == &assigned.pool<Leaf>()[0]);
+  CHECK(assigned.visit(leaf, Sum{}) == 7);
+
+  Pools moved(std::move(copy));
+  CHECK(moved.visit(leaf, Sum{}) == 7);
+  Ref added = copy.emplace<Leaf>(Leaf{ 8 });
+  CHECK(copy.visit(added, Sum{}) == 8);
+}
+
+int main() {
+  test_references();
+  test_references_survive_growth();
+  test_reserve();
+  test_copies();
+  return test::exit_code();
+}
@@ -0,0 +1,155 @@
+// Behavior checks for variant_serialize.h.
+//
+// g++ -std=c++17 -Wall -Wextra -I.. variant_serialize_test.cpp -o variant_serialize_test
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "test_harness.h"
+#include "variant_serialize.h"
+
+using namespace lius_tools;
+
+struct Point { int x, y; };
+
+struct Name {
+  std::string text;
+};
+
+namespace lius_tools {
+template <>
+struct variant_serializer<Name> {
+  static constexpr bool raw = false;
+
+  static void write(std::ostream& out, const Name& name) {
+    write_value(out, std::uint32_t(name.text.size()));
+    out.write(name.text.data(), name.text.size());
+  }
+
+  static Name read(const char*& data, const char* end) {
+    std::uint32_t size = read_value<std::uint32_t>(data, end);
+    if (size_t(end - data) < size) {
+      throw std::runtime_error("Name: truncated");
+    }
+    Name name { std::string(data, size) };
+    data += size;
+    return name;
+  }
+};
+}
+
+using Reader = variant_reader<Point, Name>;
+
+// Offsets of the fields of the first group, after the 16 byte header
+constexpr size_t first_group = 16;
+constexpr size_t count_offset = first_group + 8;
+constexpr size_t byte_size_offset = first_group + 16;
+
+// The stream, copied to a buffer aligned for any alternative
+struct Buffer {
+  std::vector<std::uint64_t> words;
+  size_t size;
+
+  explicit Buffer(const std::string& bytes) :
+      words((bytes.size() + 7) / 8),
+      size(bytes.size()) {
+    std::memcpy(words.data(), bytes.data(), bytes.size());
+  }
+
+  char* data() { return reinterpret_cast<char*>(words.data()); }
+
+  void set_u64(size_t offset, std::uint64_t value) {
+    std::memcpy(data() + offset, &value, sizeof(value));
+  }
+};
+
+template <typename T>
+std::string serialize(std::vector<T>& objects) {
+  std::vector<variant_ptr<Point, Name>> ptrs;
+  for (T& object : objects) {
+    ptrs.push_back(&object);
+  }
+  std::ostringstream out;
+  variant_writer<Point, Name> writer(out);
+  writer.write(ptrs);
+  return out.str();
+}
+
+struct Collect {
+  std::vector<Point> points;
+  std::vector<std::string> names;
+
+  void visit(const Point& point) { points.push_back(point); }
+  void visit(const Name& name) { names.push_back(name.text); }
+};
+
+void test_round_trip() {
+  std::vector<Point> points = { { 1, 2 }, { 3, 4 } };
+  std::vector<Name> names = { { "ada" }, { "grace" } };
+  Buffer buffer(serialize(points) + serialize(names).substr(16));
+  Reader reader(buffer.data(), buffer.size);
+  Collect collect;
+  reader.visit_groups(collect);
+  CHECK(collect.points.size() == 2);
+  CHECK(collect.points[1].y == 4);
+  CHECK(collect.names.size() == 2);
+  CHECK(collect.names[1] == "grace");
+
+  variant_pools<Point, Name> pools;
+  auto refs = reader.materialize(pools);
+  CHECK(refs.size() == 4);
+  CHECK(refs[0].has_type<Point>());
+  CHECK(refs[3].has_type<Name>());
+}
+
+void test_rejects_bad_headers() {
+  std::vector<Point> points = { { 1, 2 } };
+  Buffer buffer(serialize(points));
+  CHECK_THROWS(std::runtime_error, Reader(buffer.data(), 8));
+  CHECK_THROWS(std::runtime_error,
+               variant_reader<Name, Point>(buffer.data(), buffer.size));
+  buffer.data()[0] = 'X';
+  CHECK_THROWS(std::runtime_error, Reader(buffer.data(), buffer.size));
+}
+
+void test_rejects_overflowing_counts() {
+  std::vector<Point> points = { { 1, 2 } };
+  Buffer buffer(serialize(points));
+  // count * sizeof(Point) wraps around to the real byte size
+  buffer.set_u64(count_offset, (std::uint64_t(1) << 61) + 1);
+  Reader reader(buffer.data(), buffer.size);
+  Collect collect;
+  CHECK_THROWS(std::runtime_error, reader.visit_groups(collect));
+  CHECK(collect.points.empty());
+}
+
+void test_rejects_trailing_bytes() {
+  std::vector<Name> names = { { "ada" }, { "grace" } };
+  Buffer buffer(serialize(names));
+  // Drop the second element from the count, leaving its bytes behind
+  buffer.set_u64(count_offset, 1);
+  Reader reader(buffer.data(), buffer.size);
+  Collect collect;
+  CHECK_THROWS(std::runtime_error, reader.visit_groups(collect));
+}
+
+void test_rejects_truncated_groups() {
+  std::vector<Name> names = { { "ada" } };
+  Buffer buffer(serialize(names));
+  buffer.set_u64(byte_size_offset, 1 << 20);
+  Reader reader(buffer.data(), buffer.size);
+  Collect collect;
+  CHECK_THROWS(std::runtime_error, reader.visit_groups(collect));
+}
+
+int main() {
+  test_round_trip();
+  test_rejects_bad_headers();
+  test_rejects_overflowing_counts();
+  test_rejects_trailing_bytes();
+  test_rejects_truncated_groups();
+  return test::exit_code();
+}
@@ -0,0 +1,202 @@
+// Behavior checks for variant_shared_ptr.h.
+//
+// g++ -std=c++17 -Wall -Wextra -I.. variant_shared_ptr_test.cpp -o variant_shared_ptr_test -pthread
+
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "test_harness.h"
+#include "variant_shared_ptr.h"
+
+using namespace lius_tools;
+
+// Counts its destructions
+struct Tracked {
+  static int destroyed;
+
+  int value;
+
+  explicit Tracked(int v) : value(v) {}
+  ~Tracked() { ++destroyed; }
+};
+
+int Tracked::destroyed = 0;
+
+struct Small { char value; };
+
+// Needs more alignment than operator new gives by default
+struct alignas(64) Aligned {
+  static int destroyed;
+
+  int value;
+
+  explicit Aligned(int v) : value(v) {}
+  ~Aligned() { ++destroyed; }
+};
+
+int Aligned::destroyed = 0;
+
+using Ptr = variant_shared_ptr<Tracked, Small, Aligned>;
+using LocalPtr = local_variant_shared_ptr<Tracked, Small, Aligned>;
+
+struct Value {
+  int visit(const Tracked& tracked) const { return tracked.value; }
+  int visit(const Small& small) const { return small.value; }
+  int visit(const Aligned& aligned) const { return aligned.value; }
+};
+
+void test_ownership() {
+  static_assert(sizeof(Ptr) == 2 * sizeof(void*),
+                "variant_shared_ptr is a pointer and a type index");
+  Tracked::destroyed = 0;
+  {
+    Ptr p = Ptr::make<Tracked>(1);
+    CHECK(bool(p));
+    CHECK(p.type_index() == 0);
+    CHECK(p.has_type<Tracked>());
+    CHECK(p.use_count() == 1);
+    CHECK(p.visit(Value{}) == 1);
+    CHECK(p.ptr().get() == p.get());
+    CHECK(p.ptr().visit(Value{}) == 1);
+    {
+      Ptr q = p;
+      CHECK(p.use_count() == 2);
+      CHECK(q.get() == p.get());
+      CHECK(q.type_index() == 0);
+    }
+    CHECK(p.use_count() == 1);
+    CHECK(Tracked::destroyed == 0);
+  }
+  CHECK(Tracked::destroyed == 1);
+
+  Ptr empty;
+  CHECK(!empty);
+  CHECK(empty.use_count() == 0);
+  Ptr null = nullptr;
+  CHECK(!null);
+  empty.reset();
+  CHECK(!empty);
+}
+
+void test_assignment() {
+  Tracked::destroyed = 0;
+  Ptr p = Ptr::make<Tracked>(1);
+  Ptr q = Ptr::make<Small>(Small{ 2 });
+
+  // The old pointee goes once its last owner does
+  Ptr kept = p;
+  p = q;
+  CHECK(Tracked::destroyed == 0);
+  CHECK(p.type_index() == 1);
+  CHECK(p.use_count() == 2);
+  CHECK(p.visit(Value{}) == 2);
+  kept = q;
+  CHECK(Tracked::destroyed == 1);
+  CHECK(q.use_count() == 3);
+
+  Ptr& self = p;
+  p = self;
+  CHECK(p.use_count() == 3);
+  CHECK(p.visit(Value{}) == 2);
+  p = std::move(self);
+  CHECK(bool(p));
+  CHECK(p.use_count() == 3);
+
+  p.reset();
+  CHECK(!p);
+  CHECK(p.use_count() == 0);
+  CHECK(q.use_count() == 2);
+}
+
+void test_moves() {
+  Tracked::destroyed = 0;
+  Ptr p = Ptr::make<Tracked>(1);
+
+  Ptr q(std::move(p));
+  CHECK(!p);
+  CHECK(p.get() == nullptr);
+  CHECK(p.use_count() == 0);
+  CHECK(q.use_count() == 1);
+  CHECK(q.visit(Value{}) == 1);
+
+  Ptr r = Ptr::make<Tracked>(2);
+  r = std::move(q);
+  CHECK(!q);
+  CHECK(Tracked::destroyed == 1);
+  CHECK(r.use_count() == 1);
+  CHECK(r.visit(Value{}) == 1);
+
+  // A moved-from pointer can be reused
+  q = Ptr::make<Small>(Small{ 3 });
+  CHECK(q.visit(Value{}) == 3);
+  r = nullptr;
+  CHECK(Tracked::destroyed == 2);
+}
+
+void test_over_aligned() {
+  Aligned::destroyed = 0;
+  {
+    Ptr p = Ptr::make<Aligned>(4);
+    CHECK(p.type_index() == 2);
+    CHECK(reinterpret_cast<std::uintptr_t>(p.get()) % alignof(Aligned) == 0);
+    CHECK(p.visit(Value{}) == 4);
+    Ptr q = p;
+    CHECK(q.use_count() == 2);
+    p.reset();
+    CHECK(Aligned::destroyed == 0);
+    CHECK(q.use_count() == 1);
+  }
+  CHECK(Aligned::destroyed == 1);
+}
+
+void test_threads() {
+  Tracked::destroyed = 0;
+  Ptr p = Ptr::make<Tracked>(5);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([p] {
+      for (int j = 0; j < 10000; ++j) {
+        Ptr copy = p;
+        Ptr moved = std::move(copy);
+        moved.reset();
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  CHECK(p.use_count() == 1);
+  CHECK(Tracked::destroyed == 0);
+  p.reset();
+  CHECK(Tracked::destroyed == 1);
+}
+
+void test_local() {
+  Tracked::destroyed = 0;
+  Aligned::destroyed = 0;
+  {
+    LocalPtr p = LocalPtr::make<Tracked>(6);
+    LocalPtr q = p;
+    CHECK(p.use_count() == 2);
+    LocalPtr r = LocalPtr::make<Aligned>(7);
+    CHECK(reinterpret_cast<std::uintptr_t>(r.get()) % alignof(Aligned) == 0);
+    q = r;
+    CHECK(p.use_count() == 1);
+    CHECK(r.use_count() == 2);
+    CHECK(q.visit(Value{}) == 7);
+    CHECK(Tracked::destroyed == 0);
+  }
+  CHECK(Tracked::destroyed == 1);
+  CHECK(Aligned::destroyed == 1);
+}
+
+int main() {
+  test_ownership();
+  test_assignment();
+  test_moves();
+  test_over_aligned();
+  test_threads();
+  test_local();
+  return test::exit_code();
+}
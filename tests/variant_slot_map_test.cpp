@@ -0,0 +1,89 @@
+// Behavior checks for variant_slot_map.h.
+//
+// g++ -std=c++17 -Wall -Wextra -I.. variant_slot_map_test.cpp -o variant_slot_map_test
+
+#include <stdexcept>
+#include "test_harness.h"
+#include "variant_slot_map.h"
+
+using namespace lius_tools;
+
+struct Ship { int hull; };
+struct Asteroid { int mass; };
+
+using World = variant_slot_maps<Ship, Asteroid>;
+
+struct Weight {
+  int visit(const Ship& ship) const { return ship.hull; }
+  int visit(const Asteroid& asteroid) const { return asteroid.mass; }
+};
+
+void test_handles() {
+  World world;
+  auto ship = world.emplace<Ship>(Ship{ 10 });
+  auto asteroid = world.emplace<Asteroid>(Asteroid{ 20 });
+  CHECK(world.contains(ship));
+  CHECK(world.visit(ship, Weight{}) == 10);
+  CHECK(world.visit(asteroid, Weight{}) == 20);
+  CHECK(world.resolve(asteroid).type_index() == 1);
+  CHECK(world.resolve(asteroid).get() == world.get(asteroid));
+
+  const World& const_world = world;
+  variant_ptr<const Ship, const Asteroid> resolved =
+      const_world.resolve(asteroid);
+  CHECK(resolved.type_index() == 1);
+  CHECK(resolved.visit(Weight{}) == 20);
+}
+
+void test_stale_handles() {
+  World world;
+  auto first = world.emplace<Ship>(Ship{ 1 });
+  auto second = world.emplace<Ship>(Ship{ 2 });
+  CHECK(world.erase(first));
+  CHECK(!world.erase(first));
+  CHECK(!world.contains(first));
+  CHECK_THROWS(std::out_of_range, world.resolve(first));
+  CHECK_THROWS(std::out_of_range, world.visit(first, Weight{}));
+
+  // The erased slot is reused with a new generation, and the moved
+  // object is still found through its handle
+  auto third = world.emplace<Ship>(Ship{ 3 });
+  CHECK(third.slot() == first.slot());
+  CHECK(third != first);
+  CHECK(!world.contains(first));
+  CHECK(world.visit(second, Weight{}) == 2);
+  CHECK(world.visit(third, Weight{}) == 3);
+  CHECK(world.map<Ship>().size() == 2);
+}
+
+// Handles from another instance, or built by hand, can match the
+// generation of a free slot
+void test_foreign_handles_to_free_slots() {
+  World a;
+  World b;
+  auto erased = b.emplace<Ship>(Ship{ 1 });
+  CHECK(b.erase(erased));
+  CHECK(a.erase(a.emplace<Ship>(Ship{ 3 })));
+  auto foreign = a.emplace<Ship>(Ship{ 4 });
+  CHECK(foreign.slot() == erased.slot());
+  CHECK(foreign.generation() == erased.generation() + 1);
+  CHECK(!b.contains(foreign));
+  CHECK(b.get(foreign) == nullptr);
+  CHECK(!b.erase(foreign));
+  CHECK_THROWS(std::out_of_range, b.resolve(foreign));
+
+  World::handle_type forged(0, 0, 1);
+  CHECK(!b.contains(forged));
+
+  // The free slot is still reused correctly afterwards
+  auto reused = b.emplace<Ship>(Ship{ 5 });
+  CHECK(reused.slot() == erased.slot());
+  CHECK(b.visit(reused, Weight{}) == 5);
+}
+
+int main() {
+  test_handles();
+  test_stale_handles();
+  test_foreign_handles_to_free_slots();
+  return test::exit_code();
+}
@@ -0,0 +1,197 @@
+// Behavior checks for variant_unique_ptr.h.
+//
+// g++ -std=c++17 -Wall -Wextra -I.. variant_unique_ptr_test.cpp -o variant_unique_ptr_test
+
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include "test_harness.h"
+#include "variant_unique_ptr.h"
+
+using namespace lius_tools;
+
+// Counts its destructions
+struct Tracked {
+  static int destroyed;
+
+  int value;
+
+  explicit Tracked(int v) : value(v) {}
+  ~Tracked() { ++destroyed; }
+};
+
+int Tracked::destroyed = 0;
+
+struct Plain { int value; };
+
+// Comes from a fixed pool and goes back to it
+struct Pooled {
+  int value;
+};
+
+struct PooledPool {
+  Pooled slots[4];
+  int released = 0;
+  Pooled* last_released = nullptr;
+
+  void release(Pooled* pooled) {
+    ++released;
+    last_released = pooled;
+  }
+};
+
+PooledPool pool;
+
+namespace lius_tools {
+template <>
+struct variant_deleter<Pooled> {
+  static void destroy(Pooled* pooled) {
+    pool.release(pooled);
+  }
+};
+}
+
+using Ptr = variant_unique_ptr<Tracked, Plain, Pooled>;
+
+struct Value {
+  int visit(const Tracked& tracked) const { return tracked.value; }
+  int visit(const Plain& plain) const { return plain.value; }
+  int visit(const Pooled& pooled) const { return pooled.value; }
+};
+
+void test_ownership() {
+  Tracked::destroyed = 0;
+  {
+    Ptr p = Ptr::make<Tracked>(1);
+    CHECK(bool(p));
+    CHECK(p.type_index() == 0);
+    CHECK(p.visit(Value{}) == 1);
+    CHECK(p.ptr().get() == p.get());
+  }
+  CHECK(Tracked::destroyed == 1);
+
+  Ptr empty;
+  CHECK(!empty);
+  Ptr null = nullptr;
+  CHECK(!null);
+}
+
+void test_moves() {
+  Tracked::destroyed = 0;
+  Ptr p = Ptr::make<Tracked>(1);
+  Ptr q = Ptr::make<Tracked>(2);
+
+  p = std::move(q);
+  CHECK(!q);
+  CHECK(q.get() == nullptr);
+  CHECK(Tracked::destroyed == 1);
+  CHECK(p.visit(Value{}) == 2);
+
+  Ptr r(std::move(p));
+  CHECK(!p);
+  CHECK(r.visit(Value{}) == 2);
+
+  Ptr& self = r;
+  r = std::move(self);
+  CHECK(bool(r));
+  CHECK(Tracked::destroyed == 1);
+
+  r = nullptr;
+  CHECK(!r);
+  CHECK(Tracked::destroyed == 2);
+}
+
+void test_release() {
+  Tracked::destroyed = 0;
+  Tracked* raw;
+  {
+    Ptr p = Ptr::make<Tracked>(3);
+    variant_ptr<Tracked, Plain, Pooled> released = p.release();
+    CHECK(!p);
+    CHECK(released.type_index() == 0);
+    raw = static_cast<Tracked*>(released.get());
+  }
+  CHECK(Tracked::destroyed == 0);
+  delete raw;
+  CHECK(Tracked::destroyed == 1);
+}
+
+void test_pool_deleter() {
+  pool.released = 0;
+  {
+    pool.slots[2].value = 7;
+    Ptr p(&pool.slots[2]);
+    CHECK(p.type_index() == 2);
+    CHECK(p.visit(Value{}) == 7);
+    Ptr q(&pool.slots[3]);
+    p = std::move(q);
+    CHECK(pool.released == 1);
+    CHECK(pool.last_released == &pool.slots[2]);
+  }
+  CHECK(pool.released == 2);
+  CHECK(pool.last_released == &pool.slots[3]);
+}
+
+struct alignas(8) Wide { int value; };
+struct alignas(8) Narrow { int value; };
+struct alignas(8) Round { int value; };
+
+using Packed = packed_variant_unique_ptr<Wide, Narrow, Round>;
+
+struct PackedValue {
+  int visit(const Wide& wide) const { return wide.value; }
+  int visit(const Narrow& narrow) const { return narrow.value * 10; }
+  int visit(const Round& round) const { return round.value * 100; }
+};
+
+void test_packed() {
+  static_assert(Packed::tag_bits == 2, "three alternatives take two bits");
+  static_assert(sizeof(Packed) == sizeof(void*),
+                "packed_variant_unique_ptr is a single word");
+  Packed p = Packed::make<Round>(Round{ 4 });
+  CHECK(p.type_index() == 2);
+  CHECK(reinterpret_cast<std::uintptr_t>(p.get()) % alignof(Round) == 0);
+  CHECK(p.visit(PackedValue{}) == 400);
+  Packed q = Packed::make<Narrow>(Narrow{ 5 });
+  p = std::move(q);
+  CHECK(!q);
+  CHECK(p.type_index() == 1);
+  CHECK(p.visit(PackedValue{}) == 50);
+}
+
+void test_relocate() {
+  static_assert(is_trivially_relocatable<Ptr>::value,
+                "variant_unique_ptr relocates with memcpy");
+  Tracked::destroyed = 0;
+  {
+    std::vector<Ptr> source;
+    source.push_back(Ptr::make<Tracked>(1));
+    source.push_back(Ptr::make<Plain>(Plain{ 2 }));
+
+    alignas(Ptr) unsigned char storage[2 * sizeof(Ptr)];
+    Ptr* destination = reinterpret_cast<Ptr*>(storage);
+    Ptr* end = relocate(source.data(), source.data() + 2, destination);
+    CHECK(end == destination + 2);
+    CHECK(destination[0].visit(Value{}) == 1);
+    CHECK(destination[1].visit(Value{}) == 2);
+
+    // The sources are relocated away: forget them without destroying
+    // what they pointed to, then destroy the relocated copies
+    new (source.data()) Ptr();
+    new (source.data() + 1) Ptr();
+    destination[0].~Ptr();
+    destination[1].~Ptr();
+  }
+  CHECK(Tracked::destroyed == 1);
+}
+
+int main() {
+  test_ownership();
+  test_moves();
+  test_release();
+  test_pool_deleter();
+  test_packed();
+  test_relocate();
+  return test::exit_code();
+}
@@ -1,121 +1,328 @@
 #ifndef _LIUS_TOOLS_VARIANT_PTR_H_
 #define _LIUS_TOOLS_VARIANT_PTR_H_
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
 #include <type_traits>
 #include <typeinfo>
 #include <utility>
+#include <variant>
+#include <vector>
 
 namespace lius_tools {
 
+// Stands in for the result of a visitor that returns void, where a
+// value is needed
+struct void_result {};
+
 namespace {
+// The type list machinery below avoids recursive templates, so that its
+// instantiation depth does not grow with the number of alternatives.
+
+// Position of X inside Ts..., or else of the first of Ts... that X
+// converts to, or -1 if none. Exact matches come first, so that an
+// alternative deriving from an earlier one gets its own position.
 template <typename X, typename... Ts>
 struct index_of_type {
-  // fallback
-  static constexpr size_t value = -1;
+  static constexpr size_t find() {
+    constexpr bool is_same[] = { std::is_same<X, Ts>::value..., false };
+    constexpr bool is_match[] = { std::is_convertible<X, Ts>::value..., false };
+    for (size_t i = 0; i < sizeof...(Ts); ++i) {
+      if (is_same[i]) {
+        return i;
+      }
+    }
+    for (size_t i = 0; i < sizeof...(Ts); ++i) {
+      if (is_match[i]) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  static constexpr size_t value = find();
 };
 
-template <typename X, typename Y, typename... Ts>
-struct index_of_type<X, Y, Ts...> {
-  static constexpr size_t value =
-      std::conditional<std::is_convertible<X,Y>::value,
-                       std::integral_constant<size_t, 0>,
-                       std::integral_constant<size_t,
-                                              1 + index_of_type<X, Ts...>::value>
-                       >::type::value;
+template <size_t I, typename T>
+struct indexed_type {
+  using type = T;
 };
 
-template <typename... Us>
-struct TypeList {};
+template <typename TIndices, typename... Ts>
+struct indexed_types;
+
+template <size_t... Is, typename... Ts>
+struct indexed_types<std::index_sequence<Is...>, Ts...>
+    : indexed_type<Is, Ts>... {};
+
+// Overload resolution picks the only base with index I
+template <size_t I, typename T>
+indexed_type<I, T> select_indexed_type(const indexed_type<I, T>&);
+
+// The type at position I of Ts...
+template <size_t I, typename... Ts>
+using type_at = typename decltype(select_indexed_type<I>(
+    indexed_types<std::index_sequence_for<Ts...>, Ts...>{}))::type;
+
+// Result type of a dispatch whose branches return Rs...: if all of them
+// agree it is exactly that type, references included, and otherwise
+// their std::common_type.
+template <typename TVoid, typename... Rs>
+struct common_type_of_results {
+  static_assert(sizeof(TVoid*) == 0,
+                "The visit overloads return types that have no common type; "
+                "use visit_tagged to get them as a std::variant instead");
+};
+
+template <typename... Rs>
+struct common_type_of_results<std::void_t<std::common_type_t<Rs...>>, Rs...> {
+  using type = std::common_type_t<Rs...>;
+};
+
+// Keeps the result exact (references included) when every branch agrees.
+template <typename R>
+struct same_result { using type = R; };
+
+template <typename... Rs>
+struct common_result_of;
+
+template <typename R, typename... Rs>
+struct common_result_of<R, Rs...> {
+  using type = typename std::conditional_t<
+    (std::is_same<R, Rs>::value && ...),
+    same_result<R>,
+    common_type_of_results<void, R, Rs...>>::type;
+};
+
+template <typename... Rs>
+using common_result = typename common_result_of<Rs...>::type;
+
+template <typename R>
+using stored_result = std::conditional_t<
+  std::is_void<R>::value, void_result, std::decay_t<R>>;
+
+// Whether the I-th of Rs... is the first occurrence of its type
+template <size_t I, typename... Rs>
+constexpr bool is_first_occurrence() {
+  constexpr bool is_same_as_i[] = {
+    std::is_same<type_at<I, Rs...>, Rs>::value... };
+  for (size_t j = 0; j < I; ++j) {
+    if (is_same_as_i[j]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename TRs, typename TIndices>
+struct tagged_result_impl;
+
+template <typename... Rs, size_t... Is>
+struct tagged_result_impl<std::tuple<Rs...>, std::index_sequence<Is...>> {
+  template <typename... Us>
+  static std::variant<Us...> as_variant(std::tuple<Us...>);
+
+  using type = decltype(as_variant(std::tuple_cat(
+      std::declval<std::conditional_t<is_first_occurrence<Is, Rs...>(),
+                                      std::tuple<Rs>, std::tuple<>>>()...)));
+};
+
+// Holds the result of any of the branches inline, without allocating:
+// a std::variant over the distinct decayed results, with void_result in
+// place of void
+template <typename... Rs>
+using tagged_result = typename tagged_result_impl<
+  std::tuple<stored_result<Rs>...>, std::index_sequence_for<Rs...>>::type;
+
+// The dispatch core: visits ptr as the alternative at position index of
+// Ts..., through a table with one entry per alternative.
+template <typename... Ts>
+struct visit_dispatch {
+  template <typename U, typename TVisitor, typename... TExtras>
+  using branch_result_type = decltype(
+      std::declval<TVisitor&>().visit(std::declval<U&>(),
+                                      std::declval<TExtras&>()...));
+
+  template <typename TVisitor, typename... TExtras>
+  using result_type = common_result<
+    branch_result_type<Ts, TVisitor, TExtras...>...>;
+
+  template <typename TVisitor, typename... TExtras>
+  using tagged_result_type = tagged_result<
+    branch_result_type<Ts, TVisitor, TExtras...>...>;
+
+  // Cast the pointer to U* and return TVisitor::visit<U>(*ptr, extras)
+  template <typename U, typename R, typename TVisitor, typename... TExtras>
+  static R cast_and_visit(void* ptr, TVisitor& visitor, TExtras&... extras) {
+    return visitor.visit(*static_cast<U*>(ptr), extras...);
+  }
+
+  // Same, wrapping the result into the tagged result R
+  template <typename U, typename R, typename TVisitor, typename... TExtras>
+  static R cast_and_visit_tagged(
+      void* ptr, TVisitor& visitor, TExtras&... extras) {
+    using branch_result = branch_result_type<U, TVisitor, TExtras...>;
+    if constexpr (std::is_void<branch_result>::value) {
+      visitor.visit(*static_cast<U*>(ptr), extras...);
+      return R(std::in_place_type<void_result>);
+    }
+    else {
+      return R(std::in_place_type<stored_result<branch_result>>,
+               visitor.visit(*static_cast<U*>(ptr), extras...));
+    }
+  }
 
+  template <typename TVisitor, typename... TExtras>
+  static result_type<TVisitor, TExtras...> visit(
+      size_t index, void* ptr, TVisitor& visitor, TExtras&... extras) {
+    using R = result_type<TVisitor, TExtras...>;
+    static constexpr R (*table[])(void*, TVisitor&, TExtras&...) = {
+      &cast_and_visit<Ts, R, TVisitor, TExtras...>... };
+    return table[index](ptr, visitor, extras...);
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  static tagged_result_type<TVisitor, TExtras...> visit_tagged(
+      size_t index, void* ptr, TVisitor& visitor, TExtras&... extras) {
+    using R = tagged_result_type<TVisitor, TExtras...>;
+    static constexpr R (*table[])(void*, TVisitor&, TExtras&...) = {
+      &cast_and_visit_tagged<Ts, R, TVisitor, TExtras...>... };
+    return table[index](ptr, visitor, extras...);
+  }
+};
+
+// Position of U inside Ts... for conversions between variant_ptrs: the
+// same type, or the same type with const added. -1 if none.
+template <typename U, typename... Ts>
+constexpr size_t converted_index() {
+  constexpr bool is_match[] = {
+    (std::is_same<U, Ts>::value || std::is_same<const U, Ts>::value)...,
+    false };
+  for (size_t i = 0; i < sizeof...(Ts); ++i) {
+    if (is_match[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Maps type indices of Us... to type indices of Ts...
 template <typename... Ts>
-struct head;
+struct index_remap {
+  template <typename... Us>
+  struct from {
+    static constexpr size_t table[] = { converted_index<Us, Ts...>()... };
 
-template <typename T, typename... Ts>
-struct head<T, Ts...> {
-  using type = T;
+    static constexpr bool is_total =
+        ((converted_index<Us, Ts...>() != size_t(-1)) && ...);
+  };
 };
 
+// Builds variant_ptrs from a pointer and a type index, for the
+// conversions below
+template <typename TVariant>
+struct variant_ptr_access;
+
 }
 
 template <typename... Ts>
 class variant_ptr {
- private:
-  using types = TypeList<Ts...>;
-  using example_visitee_type = typename head<Ts...>::type;
-
  public:
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  // The alternative at position I of Ts...
+  template <size_t I>
+  using type = type_at<I, Ts...>;
+
+  // A null pointer with type index 0, which must not be visited
+  variant_ptr() :
+      ptr_(nullptr),
+      type_index_(0) {}
+
+  variant_ptr(std::nullptr_t) :
+      variant_ptr() {}
+
   template <typename X>
   variant_ptr(X* ptr) {
     reset(ptr);
   }
 
+  // Converts from a variant_ptr whose alternatives are all among Ts...
+  // (possibly in another order, or without const), by one lookup in a
+  // constant table of type indices. Other variant_ptrs do not convert
+  // implicitly, so that overloads taking different variant_ptrs stay
+  // unambiguous; use variant_cast for them.
+  template <typename... Us,
+            typename = std::enable_if_t<
+              index_remap<Ts...>::template from<Us...>::is_total>>
+  variant_ptr(const variant_ptr<Us...>& other) :
+      ptr_(other.get()),
+      type_index_(
+          index_remap<Ts...>::template from<Us...>::table[other.type_index()]) {}
+
   template <typename X>
   void reset(X* ptr) {
+    static_assert(index_of_type<X, Ts...>::value != size_t(-1),
+                  "X is not one of the alternatives of this variant_ptr");
     type_index_= index_of_type<X, Ts...>::value;
     ptr_ = (void *)(ptr);
   }
 
+  // Position of X inside Ts...
   template <typename X>
-  bool has_type() {
-    return has_type_impl<X>(TypeList<Ts...>{});
+  static constexpr size_t index_of() {
+    return index_of_type<X, Ts...>::value;
   }
 
+  template <typename X>
+  bool has_type() const {
+    constexpr bool is_x[] = { std::is_same<X, Ts>::value... };
+    return is_x[type_index_];
+  }
+
+  // Returns the visitor's result; when the overloads disagree on their
+  // return type, the std::common_type of all of them
   template <typename TVisitor, typename... TExtras>
-  auto visit(
+  decltype(auto) visit(
       TVisitor&& visitor, TExtras&&... extras) const {
-    return visit_impl(
-        visitor, TypeList<Ts...>{}, extras...);
+    return visit_dispatch<Ts...>::visit(
+        type_index_, ptr_, visitor, extras...);
   }
 
- private:
-  template <typename X, typename U, typename... Us>
-  bool has_type_impl(TypeList<U, Us...>) const {
-    bool u_is_correct_type =
-        type_index_ == (sizeof...(Ts) - (1+sizeof...(Us)));
-    if (u_is_correct_type) {
-      return std::is_same<X, U>::value;
-    }
-    else {
-      return has_type_impl<X>(TypeList<Us...>{});
-    }
+  // Returns the visitor's result as a std::variant over the distinct
+  // return types of its overloads, for overloads without a common type
+  template <typename TVisitor, typename... TExtras>
+  auto visit_tagged(
+      TVisitor&& visitor, TExtras&&... extras) const {
+    return visit_dispatch<Ts...>::visit_tagged(
+        type_index_, ptr_, visitor, extras...);
   }
 
-  template <typename X, typename U>
-  bool has_type_impl(TypeList<U>) const {
-    return std::is_same<X, U>::value;
+  // The raw pointee, without any type information
+  void* get() const {
+    return ptr_;
   }
 
-  // Cast the pointer to U* and return TVisitor::visit<U>(*ptr, extras)
-  template <typename U, typename TVisitor, typename... TExtras>
-  auto cast_and_visit(
-      TVisitor&& visitor, TExtras... extras) const {
-    U* casted_ptr = (U*)ptr_;
-    return visitor.visit(*casted_ptr, extras...);
+  // Position of the pointee's type inside Ts...
+  size_t type_index() const {
+    return type_index_;
   }
 
-  // Recursive visit_impl.
-  template <typename TVisitor,
-            typename U, typename... Us, typename... TExtras>
-  auto visit_impl(
-      TVisitor&& visitor, TypeList<U, Us...>, TExtras&&... extras) const {
-    if (type_index_ == (sizeof...(Ts) - (1 + sizeof...(Us)))) {
-      return cast_and_visit<U>(visitor, extras...);
-    }
-    else {
-      // recurse
-      return visit_impl(visitor, TypeList<Us...>{}, extras...);
-    }
-  };
+  explicit operator bool() const {
+    return ptr_ != nullptr;
+  }
 
-  // Base case visit_impl: should never be reached since the type list
-  // is now empty. Any expression that evaluates to a compatible return
-  // type can returned.
-  template <typename TVisitor,
-            typename... TExtras>
-  auto visit_impl(
-      TVisitor&& visitor, TypeList<>, TExtras&&... extras) const {
-    return cast_and_visit<example_visitee_type>(visitor, extras...);
-  };
+ private:
+  template <typename TVariant>
+  friend struct variant_ptr_access;
+
+  variant_ptr(void* ptr, size_t type_index) :
+      ptr_(ptr),
+      type_index_(type_index) {}
 
   void* ptr_;
   size_t type_index_;
@@ -124,6 +331,280 @@ class variant_ptr {
 template <typename... Ts>
 using const_variant_ptr = variant_ptr<const Ts...>;
 
+// variant_ptrs can be copied, moved and relocated with memcpy, e.g. by
+// std::vector when it grows
+static_assert(std::is_trivially_copyable<variant_ptr<int>>::value,
+              "variant_ptr must stay trivially copyable");
+
+namespace {
+template <typename TVariant>
+struct variant_ptr_access {
+  static TVariant make(void* ptr, size_t type_index) {
+    return TVariant(ptr, type_index);
+  }
+};
+
+template <typename TVariant>
+struct variant_cast_impl;
+
+template <typename... Ts>
+struct variant_cast_impl<variant_ptr<Ts...>> {
+  template <typename... Us>
+  static variant_ptr<Ts...> convert(const variant_ptr<Us...>& ptr) {
+    size_t index =
+        index_remap<Ts...>::template from<Us...>::table[ptr.type_index()];
+    if (index == size_t(-1)) {
+      throw std::bad_cast();
+    }
+    return variant_ptr_access<variant_ptr<Ts...>>::make(ptr.get(), index);
+  }
+};
+}
+
+// Converts between variant_ptrs whose alternatives only partially
+// overlap. Throws std::bad_cast when ptr's alternative is not one of
+// TVariant's.
+template <typename TVariant, typename... Us>
+TVariant variant_cast(const variant_ptr<Us...>& ptr) {
+  return variant_cast_impl<TVariant>::convert(ptr);
+}
+
+// Writes [first, last), a range of variant_ptrs, converted to TVariant
+// into out, and returns the output iterator past the last element. The
+// conversion must be total, as for the converting constructor, so that
+// the loop body is one table load (a gather, when vectorized).
+template <typename TVariant, typename TIterator, typename TOutputIterator>
+TOutputIterator convert_variants(
+    TIterator first, TIterator last, TOutputIterator out) {
+  for (; first != last; ++first) {
+    *out = TVariant(*first);
+    ++out;
+  }
+  return out;
+}
+
+// Points out[i] at first[i] for i < n, for building large arrays of
+// variant_ptrs to objects of the same type T. The type index is
+// resolved once, so the loop only stores each pointer next to a
+// constant, without any per-element dispatch or branch.
+template <typename... Ts, typename T>
+void assign_homogeneous(variant_ptr<Ts...>* out, T* const* first, size_t n) {
+  constexpr size_t index = index_of_type<T, Ts...>::value;
+  static_assert(index != size_t(-1),
+                "T is not one of the alternatives of this variant_ptr");
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = variant_ptr_access<variant_ptr<Ts...>>::make(
+        const_cast<void*>(static_cast<const void*>(first[i])), index);
+  }
+}
+
+// Same, pointing out[i] at objects[i], for objects stored contiguously
+template <typename... Ts, typename T>
+void assign_contiguous(variant_ptr<Ts...>* out, T* objects, size_t n) {
+  constexpr size_t index = index_of_type<T, Ts...>::value;
+  static_assert(index != size_t(-1),
+                "T is not one of the alternatives of this variant_ptr");
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = variant_ptr_access<variant_ptr<Ts...>>::make(
+        const_cast<void*>(static_cast<const void*>(objects + i)), index);
+  }
+}
+
+// std::variant interop:
+//
+// as_variant_ptr views a std::variant<Ts...> as a variant_ptr<Ts...> to
+// its active alternative, and a std::variant<Ts*...> as a
+// variant_ptr<Ts...> to the pointee, without copying anything:
+//
+// std::variant<Rock, Paper> hand = Paper{};
+// as_variant_ptr(hand).visit(get_description);
+//
+// apply_multi_visitor accepts either kind of std::variant directly as
+// one of its num_variants variants, mixed with variant_ptrs, and
+// dispatches through the same tables; extra arguments after the
+// variants are passed on unchanged. The
+// view must not outlive the std::variant, nor its alternative change;
+// a std::variant<Ts*...> must not hold a null pointer. A valueless
+// std::variant throws std::bad_variant_access.
+namespace {
+// The address of variant's alternative I, or with to_pointee, of what
+// that alternative points to
+template <typename TVariant, typename TStdVariant, bool to_pointee, size_t I>
+TVariant variant_ptr_to(TStdVariant& variant) {
+  const void* address;
+  if constexpr (to_pointee) {
+    address = *std::get_if<I>(&variant);
+  }
+  else {
+    address = std::get_if<I>(&variant);
+  }
+  return variant_ptr_access<TVariant>::make(const_cast<void*>(address), I);
+}
+
+// Converts through a table indexed by variant.index()
+template <typename TVariant, typename TStdVariant, bool to_pointee,
+          size_t... Is>
+TVariant variant_ptr_from_std(TStdVariant& variant,
+                              std::index_sequence<Is...>) {
+  if (variant.valueless_by_exception()) {
+    throw std::bad_variant_access();
+  }
+  static constexpr TVariant (*table[])(TStdVariant&) = {
+    &variant_ptr_to<TVariant, TStdVariant, to_pointee, Is>... };
+  return table[variant.index()](variant);
+}
+}
+
+template <typename... Ts>
+variant_ptr<Ts...> as_variant_ptr(std::variant<Ts...>& variant) {
+  return variant_ptr_from_std<variant_ptr<Ts...>, std::variant<Ts...>, false>(
+      variant, std::index_sequence_for<Ts...>{});
+}
+
+template <typename... Ts>
+variant_ptr<const Ts...> as_variant_ptr(const std::variant<Ts...>& variant) {
+  return variant_ptr_from_std<variant_ptr<const Ts...>,
+                              const std::variant<Ts...>, false>(
+      variant, std::index_sequence_for<Ts...>{});
+}
+
+template <typename... Ts>
+variant_ptr<Ts...> as_variant_ptr(std::variant<Ts*...>& variant) {
+  return variant_ptr_from_std<variant_ptr<Ts...>, std::variant<Ts*...>, true>(
+      variant, std::index_sequence_for<Ts...>{});
+}
+
+template <typename... Ts>
+variant_ptr<Ts...> as_variant_ptr(const std::variant<Ts*...>& variant) {
+  return variant_ptr_from_std<variant_ptr<Ts...>,
+                              const std::variant<Ts*...>, true>(
+      variant, std::index_sequence_for<Ts...>{});
+}
+
+// Visits ptr as the alternative at position index of Ts..., through the
+// same table as variant_ptr::visit, for callers that already have a
+// type index and a raw pointer, e.g. frame decoders:
+//
+// visit_by_index<const Login, const Logout>(kind, payload, handler);
+//
+// index must be smaller than sizeof...(Ts). The pointee is accessed as
+// the chosen alternative, so use const alternatives for read-only data.
+template <typename... Ts, typename TVisitor, typename... TExtras>
+decltype(auto) visit_by_index(size_t index, const void* ptr,
+                              TVisitor&& visitor, TExtras&&... extras) {
+  return visit_dispatch<Ts...>::visit(
+      index, const_cast<void*>(ptr), visitor, extras...);
+}
+
+// Conversion from polymorphic base pointers:
+//
+// Legacy hierarchies hand out Base*, and converting one into a
+// variant_ptr would take a dynamic_cast per alternative. Instead,
+//
+// auto hand = from_polymorphic<HandPtr>(base_ptr);
+//
+// looks up typeid(*base_ptr) in a hash table from std::type_info to
+// type index, built once per (variant_ptr, Base) pair on first use. A
+// thread local cache of the last type seen skips the lookup entirely
+// for runs of objects of the same type. The dynamic type must be
+// exactly one of the alternatives, otherwise std::bad_cast is thrown;
+// Base must be polymorphic and ptr must not be null.
+namespace {
+template <typename TBase, typename... Ts>
+struct polymorphic_index_table {
+  struct entry {
+    const std::type_info* type;
+    size_t index;
+  };
+
+  // Power of two, at most half full
+  static constexpr size_t capacity() {
+    size_t capacity = 1;
+    while (capacity < 2 * sizeof...(Ts)) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  std::array<entry, capacity()> entries {};
+
+  polymorphic_index_table() {
+    const std::type_info* types[] = {
+      &typeid(typename std::remove_const<Ts>::type)... };
+    for (size_t i = 0; i < sizeof...(Ts); ++i) {
+      size_t slot = types[i]->hash_code() & (capacity() - 1);
+      while (entries[slot].type != nullptr) {
+        slot = (slot + 1) & (capacity() - 1);
+      }
+      entries[slot] = entry { types[i], i };
+    }
+  }
+
+  // Position of type inside Ts..., or -1
+  size_t find(const std::type_info& type) const {
+    size_t slot = type.hash_code() & (capacity() - 1);
+    while (entries[slot].type != nullptr) {
+      if (*entries[slot].type == type) {
+        return entries[slot].index;
+      }
+      slot = (slot + 1) & (capacity() - 1);
+    }
+    return -1;
+  }
+
+  static const polymorphic_index_table& instance() {
+    static const polymorphic_index_table table;
+    return table;
+  }
+};
+
+// Keeps the looked up index I, which the variant_ptr(U*) constructor
+// could not tell apart from that of a base of U among the alternatives
+template <typename TVariant, typename TBase, typename U, size_t I>
+TVariant from_polymorphic_as(TBase* ptr) {
+  return variant_ptr_access<TVariant>::make(
+      const_cast<void*>(static_cast<const void*>(static_cast<U*>(ptr))), I);
+}
+
+template <typename TVariant, typename TBase, typename TIndices>
+struct polymorphic_conversion;
+
+template <typename... Ts, typename TBase, size_t... Is>
+struct polymorphic_conversion<variant_ptr<Ts...>, TBase,
+                              std::index_sequence<Is...>> {
+  static_assert(std::is_polymorphic<TBase>::value,
+                "from_polymorphic needs a polymorphic base");
+
+  static variant_ptr<Ts...> convert(TBase* ptr) {
+    using table_type = polymorphic_index_table<TBase, Ts...>;
+    static thread_local const std::type_info* cached_type = nullptr;
+    static thread_local size_t cached_index = 0;
+
+    const std::type_info& type = typeid(*ptr);
+    if (cached_type == nullptr || *cached_type != type) {
+      size_t index = table_type::instance().find(type);
+      if (index == size_t(-1)) {
+        throw std::bad_cast();
+      }
+      cached_type = &type;
+      cached_index = index;
+    }
+
+    static constexpr variant_ptr<Ts...> (*table[])(TBase*) = {
+      &from_polymorphic_as<variant_ptr<Ts...>, TBase,
+                           type_at<Is, Ts...>, Is>... };
+    return table[cached_index](ptr);
+  }
+};
+}
+
+template <typename TVariant, typename TBase>
+TVariant from_polymorphic(TBase* ptr) {
+  return polymorphic_conversion<
+    TVariant, TBase, std::make_index_sequence<TVariant::num_types>>::convert(
+        ptr);
+}
+
 
 // MultiVisitor support:
 //
@@ -152,7 +633,7 @@ class BindVisitor {
       element_(e) {}
 
   template <typename... Ts>
-  auto visit(Ts&&... ts) {
+  decltype(auto) visit(Ts&&... ts) {
     return multi_visitor_.visit(element_, ts...);
   }
 
@@ -180,7 +661,7 @@ class MultiVisitorToSingleVisitor {
   using _ = typename std::enable_if<(num_variants >= 2)>::type;
 
   template <typename A, typename TVariant, typename... TExtras>
-  auto visit(A&& a, TVariant&& variant, TExtras&&... extras) {
+  decltype(auto) visit(A&& a, TVariant&& variant, TExtras&&... extras) {
     // What have I done
     BindVisitor<TMultiVisitor, A> bind_visitor { multi_visitor_, a };
     MultiVisitorToSingleVisitor<BindVisitor<TMultiVisitor, A>, num_variants-1>
@@ -200,7 +681,7 @@ class MultiVisitorToSingleVisitor<TMultiVisitor, 1> {
   MultiVisitorToSingleVisitor(TMultiVisitor& multi_visitor) :
       multi_visitor_(multi_visitor) {}
   template <typename A, typename... TExtras>
-  auto visit(A&& a, TExtras&&... extras) {
+  decltype(auto) visit(A&& a, TExtras&&... extras) {
     return multi_visitor_.visit(a, extras...);
   }
 
@@ -208,13 +689,1062 @@ class MultiVisitorToSingleVisitor<TMultiVisitor, 1> {
   TMultiVisitor& multi_visitor_;
 };
 
+// Type-only MultiVisitors:
+//
+// Some visitors ignore the visited objects and only depend on their
+// types, e.g. LosesTo in main.cpp. Such a visitor can declare
+//
+// struct LosesTo {
+//    static constexpr bool type_only = true;
+//    static constexpr bool visit(Rock rock, Paper paper) { ... }
+//    ...
+// };
+//
+// (or specialize is_type_only_visitor), and apply_multi_visitor will
+// then evaluate it for every combination of alternatives at compile
+// time, replacing the dispatch with a single table lookup indexed by
+// the variants' type indices. The visit overloads must be constexpr and
+// take their arguments by value or const reference, and the visitor,
+// its results and the alternatives must be default constructible
+// literal types.
+template <typename TVisitor, typename = void>
+struct is_type_only_visitor : std::false_type {};
+
+template <typename TVisitor>
+struct is_type_only_visitor<
+  TVisitor, std::void_t<decltype(TVisitor::type_only)>>
+    : std::integral_constant<bool, TVisitor::type_only> {};
+
+namespace {
+template <typename... Ns>
+constexpr size_t product(Ns... ns) {
+  return (size_t(1) * ... * ns);
+}
+
+template <typename TVisitor, typename TIndices, typename... TVariants>
+struct type_only_table;
+
+template <typename TVisitor, size_t... Is, typename... TVariants>
+struct type_only_table<TVisitor, std::index_sequence<Is...>, TVariants...> {
+  using result_type = typename std::decay<decltype(
+      TVisitor{}.visit(typename TVariants::template type<0>{}...))>::type;
+
+  static constexpr size_t num_types[] = { TVariants::num_types... };
+
+  // Position of variant k's alternative inside the flat index i
+  static constexpr size_t digit(size_t i, size_t k) {
+    size_t stride = 1;
+    for (size_t j = k + 1; j < sizeof...(TVariants); ++j) {
+      stride *= num_types[j];
+    }
+    return (i / stride) % num_types[k];
+  }
+
+  template <size_t I, size_t... Ks>
+  static constexpr result_type entry(std::index_sequence<Ks...>) {
+    return TVisitor{}.visit(
+        typename TVariants::template type<digit(I, Ks)>{}...);
+  }
+
+  static constexpr result_type values[] = {
+    entry<Is>(std::index_sequence_for<TVariants...>{})... };
+
+  static result_type lookup(const TVariants&... variants) {
+    size_t flat_index = 0;
+    ((flat_index = flat_index * TVariants::num_types + variants.type_index()),
+     ...);
+    return values[flat_index];
+  }
+};
+}
+
+// Symmetric MultiVisitors:
+//
+// Double dispatch is often symmetric, e.g. a collision between a
+// Circle and a Box is the same as one between a Box and a Circle. A
+// binary visitor can declare
+//
+// struct Collide {
+//    static constexpr bool symmetric = true;
+//    void visit(Circle& a, Circle& b);
+//    void visit(Circle& a, Box& b);
+//    void visit(Box& a, Box& b);
+// };
+//
+// (or specialize is_symmetric_visitor) and then only needs to handle
+// visit(Ti, Tj) for i <= j, where i and j are positions in the variant's
+// type list. apply_multi_visitor<2> orders the two variants by type
+// index, swapping them if needed, so only the upper triangle of the
+// type pair space is instantiated. Both variants must have the same type.
+template <typename TVisitor, typename = void>
+struct is_symmetric_visitor : std::false_type {};
+
+template <typename TVisitor>
+struct is_symmetric_visitor<
+  TVisitor, std::void_t<decltype(TVisitor::symmetric)>>
+    : std::integral_constant<bool, TVisitor::symmetric> {};
+
+namespace {
+// Flat position of the pair (i, j), i <= j, in the upper triangle of an
+// n by n matrix
+constexpr size_t triangle_index(size_t i, size_t j, size_t n) {
+  return i * (2 * n - i + 1) / 2 + (j - i);
+}
+
+// Inverse of triangle_index
+constexpr size_t triangle_row(size_t k, size_t n) {
+  size_t i = 0;
+  while (k >= n - i) {
+    k -= n - i;
+    ++i;
+  }
+  return i;
+}
+
+constexpr size_t triangle_column(size_t k, size_t n) {
+  size_t i = triangle_row(k, n);
+  return i + (k - triangle_index(i, i, n));
+}
+
+template <typename TVisitor, typename TVariant, typename TIndices>
+struct symmetric_table;
+
+template <typename TVisitor, typename TVariant, size_t... Ks>
+struct symmetric_table<TVisitor, TVariant, std::index_sequence<Ks...>> {
+  static constexpr size_t n = TVariant::num_types;
+
+  template <size_t K>
+  using first_type = typename TVariant::template type<triangle_row(K, n)>;
+
+  template <size_t K>
+  using second_type = typename TVariant::template type<triangle_column(K, n)>;
+
+  using result_type = common_result<decltype(
+      std::declval<TVisitor&>().visit(std::declval<first_type<Ks>&>(),
+                                      std::declval<second_type<Ks>&>()))...>;
+  using thunk_type = result_type (*)(TVisitor&, void*, void*);
+
+  template <size_t K>
+  static result_type thunk(TVisitor& visitor, void* a, void* b) {
+    return visitor.visit(*static_cast<first_type<K>*>(a),
+                         *static_cast<second_type<K>*>(b));
+  }
+
+  static constexpr thunk_type thunks[] = { &thunk<Ks>... };
+
+  static result_type dispatch(
+      TVisitor& visitor, const TVariant& a, const TVariant& b) {
+    size_t i = a.type_index();
+    size_t j = b.type_index();
+    if (i <= j) {
+      return thunks[triangle_index(i, j, n)](visitor, a.get(), b.get());
+    }
+    else {
+      return thunks[triangle_index(j, i, n)](visitor, b.get(), a.get());
+    }
+  }
+};
+}
+
+// Sparse MultiVisitors:
+//
+// At high arity the dense dispatch instantiates every combination of
+// alternatives, e.g. 16^4 = 65536 for four variants over 16 types, even
+// when only a handful of combinations need specific handling. A sparse
+// visitor lists those combinations and handles everything else in a
+// single visit_default that receives the variants themselves:
+//
+// struct Interact {
+//    using sparse_cases = case_list<
+//      sparse_case<Ship, Asteroid, Laser>,
+//      sparse_case<Ship, Ship, Shield>>;
+//
+//    void visit(Ship& a, Asteroid& b, Laser& c);
+//    void visit(Ship& a, Ship& b, Shield& c);
+//    void visit_default(const BodyPtr& a, const BodyPtr& b, const ItemPtr& c);
+// };
+//
+// apply_multi_visitor then only instantiates the listed combinations,
+// and finds them with a binary search over their sorted combined type
+// indices. All other combinations share one call to visit_default.
+template <typename... Us>
+struct sparse_case {};
+
+template <typename... TCases>
+struct case_list {};
+
+template <typename TVisitor, typename = void>
+struct is_sparse_visitor : std::false_type {};
+
+template <typename TVisitor>
+struct is_sparse_visitor<
+  TVisitor, std::void_t<typename TVisitor::sparse_cases>>
+    : std::true_type {};
+
+namespace {
+// Combined (row-major) index of a combination of alternatives
+template <typename... TVariants, typename... Us>
+constexpr size_t sparse_case_key(sparse_case<Us...>) {
+  static_assert(sizeof...(Us) == sizeof...(TVariants),
+                "sparse_case arity does not match the number of variants");
+  const size_t indices[] = { TVariants::template index_of<Us>()... };
+  const size_t num_types[] = { TVariants::num_types... };
+  size_t key = 0;
+  for (size_t k = 0; k < sizeof...(TVariants); ++k) {
+    key = key * num_types[k] + indices[k];
+  }
+  return key;
+}
+
+template <size_t N>
+struct sparse_keys {
+  size_t keys[N];
+  size_t cases[N];  // position of keys[i] inside the case_list
+};
+
+template <size_t N>
+constexpr sparse_keys<N> sort_sparse_keys(sparse_keys<N> sorted) {
+  for (size_t i = 1; i < N; ++i) {
+    for (size_t j = i; j > 0 && sorted.keys[j - 1] > sorted.keys[j]; --j) {
+      size_t key = sorted.keys[j];
+      sorted.keys[j] = sorted.keys[j - 1];
+      sorted.keys[j - 1] = key;
+      size_t case_position = sorted.cases[j];
+      sorted.cases[j] = sorted.cases[j - 1];
+      sorted.cases[j - 1] = case_position;
+    }
+  }
+  return sorted;
+}
+
+template <size_t N>
+constexpr bool has_unique_keys(const sparse_keys<N>& sorted) {
+  for (size_t i = 1; i < N; ++i) {
+    if (sorted.keys[i - 1] == sorted.keys[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename TVisitor, typename TCases, typename TIndices,
+          typename... TVariants>
+struct sparse_table;
+
+template <typename TVisitor, typename... TCases, size_t... Cs,
+          typename... TVariants>
+struct sparse_table<TVisitor, case_list<TCases...>,
+                    std::index_sequence<Cs...>, TVariants...> {
+  static_assert(sizeof...(TCases) >= 1, "sparse_cases is empty");
+
+  template <typename TCase>
+  struct case_result;
+
+  template <typename... Us>
+  struct case_result<sparse_case<Us...>> {
+    using type = decltype(
+        std::declval<TVisitor&>().visit(std::declval<Us&>()...));
+  };
+
+  using result_type = common_result<
+    decltype(std::declval<TVisitor&>().visit_default(
+        std::declval<const TVariants&>()...)),
+    typename case_result<TCases>::type...>;
+  using thunk_type = result_type (*)(TVisitor&, void* const*);
+
+  static constexpr sparse_keys<sizeof...(TCases)> sorted =
+      sort_sparse_keys(sparse_keys<sizeof...(TCases)> {
+          { sparse_case_key<TVariants...>(TCases{})... }, { Cs... } });
+
+  static_assert(has_unique_keys(sorted),
+                "sparse_cases has a duplicate sparse_case");
+
+  template <typename... Us, size_t... Ks>
+  static result_type visit_case(
+      TVisitor& visitor, void* const* ptrs,
+      sparse_case<Us...>, std::index_sequence<Ks...>) {
+    static_assert(((TVariants::template index_of<Us>() != size_t(-1)) && ...),
+                  "sparse_case type is not an alternative of its variant");
+    return visitor.visit(
+        *static_cast<typename TVariants::template type<
+          TVariants::template index_of<Us>()>*>(ptrs[Ks])...);
+  }
+
+  template <typename TCase>
+  static result_type thunk(TVisitor& visitor, void* const* ptrs) {
+    return visit_case(
+        visitor, ptrs, TCase{}, std::index_sequence_for<TVariants...>{});
+  }
+
+  template <size_t position>
+  using case_at = type_at<position, TCases...>;
+
+  static constexpr thunk_type thunks[] = {
+    &thunk<case_at<sorted.cases[Cs]>>... };
+
+  // Number of combinations sharing the same first alternative
+  static constexpr size_t row_stride =
+      product(TVariants::num_types...) /
+      type_at<0, TVariants...>::num_types;
+
+  // Position of the first sorted key not less than key
+  static constexpr size_t lower_position(size_t key) {
+    size_t position = 0;
+    while (position < sizeof...(TCases) && sorted.keys[position] < key) {
+      ++position;
+    }
+    return position;
+  }
+
+  // Looks key up among the sorted keys in [first, last)
+  static result_type dispatch_in(
+      size_t first, size_t last, size_t key,
+      TVisitor& visitor, const TVariants&... variants) {
+    const size_t* keys_end = sorted.keys + last;
+    const size_t* found = std::lower_bound(sorted.keys + first, keys_end, key);
+    if (found != keys_end && *found == key) {
+      void* const ptrs[] = { variants.get()... };
+      return thunks[found - sorted.keys](visitor, ptrs);
+    }
+    else {
+      return visitor.visit_default(variants...);
+    }
+  }
+
+  static result_type dispatch(
+      TVisitor& visitor, const TVariants&... variants) {
+    size_t key = 0;
+    ((key = key * TVariants::num_types + variants.type_index()), ...);
+    return dispatch_in(0, sizeof...(TCases), key, visitor, variants...);
+  }
+};
+
+template <typename TCases>
+struct case_list_size;
+
+template <typename... TCases>
+struct case_list_size<case_list<TCases...>>
+    : std::integral_constant<size_t, sizeof...(TCases)> {};
+
+// Tags selecting how apply_multi_visitor dispatches
+struct dense_multi_dispatch {};
+struct type_only_multi_dispatch {};
+struct symmetric_multi_dispatch {};
+struct sparse_multi_dispatch {};
+
+template <typename TVisitor, size_t num_variants, typename... TArguments>
+struct multi_dispatch_mode {
+  static constexpr bool all_variants =
+      num_variants == sizeof...(TArguments);
+  static constexpr bool symmetric_pair =
+      num_variants == 2 && all_variants &&
+      std::is_same<type_at<0, TArguments...>,
+                   type_at<sizeof...(TArguments) - 1, TArguments...>>::value;
+  static constexpr bool type_only =
+      is_type_only_visitor<TVisitor>::value && all_variants;
+
+  // Symmetric and sparse visitors need not provide the overloads that
+  // the dense dispatch would call instead
+  static_assert(type_only || !is_symmetric_visitor<TVisitor>::value ||
+                symmetric_pair,
+                "a symmetric visitor takes exactly two variants of the same "
+                "type, without extra arguments");
+  static_assert(type_only || !is_sparse_visitor<TVisitor>::value ||
+                all_variants,
+                "a sparse visitor takes no extra arguments after its "
+                "variants");
+
+  using type = typename std::conditional<
+    type_only,
+    type_only_multi_dispatch,
+    typename std::conditional<
+      is_symmetric_visitor<TVisitor>::value && symmetric_pair,
+      symmetric_multi_dispatch,
+      typename std::conditional<
+        is_sparse_visitor<TVisitor>::value && all_variants,
+        sparse_multi_dispatch,
+        dense_multi_dispatch>::type>::type>::type;
+};
+
 template <size_t num_variants, typename TVisitor, typename TVariant, typename... TExtras>
-auto apply_multi_visitor(
+decltype(auto) apply_multi_visitor_impl(
+    dense_multi_dispatch,
     TVisitor&& visitor, TVariant&& variant, TExtras&&... extras) {
   MultiVisitorToSingleVisitor<TVisitor, num_variants> single_visitor { visitor };
   return variant.visit(single_visitor, extras...);
 }
 
+template <size_t num_variants, typename TVisitor, typename... TVariants>
+auto apply_multi_visitor_impl(
+    type_only_multi_dispatch,
+    TVisitor&&, const TVariants&... variants) {
+  using table = type_only_table<
+    typename std::decay<TVisitor>::type,
+    std::make_index_sequence<product(std::decay<TVariants>::type::num_types...)>,
+    typename std::decay<TVariants>::type...>;
+  return table::lookup(variants...);
+}
+
+template <size_t num_variants, typename TVisitor, typename TVariant>
+decltype(auto) apply_multi_visitor_impl(
+    symmetric_multi_dispatch,
+    TVisitor&& visitor, const TVariant& a, const TVariant& b) {
+  using table = symmetric_table<
+    typename std::remove_reference<TVisitor>::type,
+    TVariant,
+    std::make_index_sequence<TVariant::num_types * (TVariant::num_types + 1) / 2>>;
+  return table::dispatch(visitor, a, b);
+}
+
+template <size_t num_variants, typename TVisitor, typename... TVariants>
+decltype(auto) apply_multi_visitor_impl(
+    sparse_multi_dispatch,
+    TVisitor&& visitor, const TVariants&... variants) {
+  using visitor_type = typename std::remove_reference<TVisitor>::type;
+  using cases = typename visitor_type::sparse_cases;
+  using table = sparse_table<
+    visitor_type, cases,
+    std::make_index_sequence<case_list_size<cases>::value>,
+    TVariants...>;
+  return table::dispatch(visitor, variants...);
+}
+}
+
+namespace {
+template <typename T>
+struct is_std_variant : std::false_type {};
+
+template <typename... Ts>
+struct is_std_variant<std::variant<Ts...>> : std::true_type {};
+
+// std::variants become variant_ptr views, anything else is passed on
+template <typename T>
+decltype(auto) as_dispatchable(T& argument) {
+  if constexpr (is_std_variant<typename std::remove_const<T>::type>::value) {
+    return as_variant_ptr(argument);
+  }
+  else {
+    return argument;
+  }
+}
+
+template <size_t num_variants, typename TVisitor, typename TVariant, typename... TExtras>
+decltype(auto) apply_multi_visitor_dispatchable(
+    TVisitor&& visitor, TVariant&& variant, TExtras&&... extras) {
+  using mode = typename multi_dispatch_mode<
+    typename std::decay<TVisitor>::type, num_variants,
+    typename std::decay<TVariant>::type,
+    typename std::decay<TExtras>::type...>::type;
+  return apply_multi_visitor_impl<num_variants>(
+      mode{}, visitor, variant, extras...);
+}
+
+// Only the variants are converted; the arguments after them reach the
+// visitor unchanged, even when they are std::variants
+template <bool is_variant, typename T>
+decltype(auto) as_dispatchable_if(T& argument) {
+  if constexpr (is_variant) {
+    return as_dispatchable(argument);
+  }
+  else {
+    return argument;
+  }
+}
+
+template <size_t num_variants, typename TVisitor, typename TVariant,
+          size_t... Is, typename... TExtras>
+decltype(auto) apply_multi_visitor_converted(
+    std::index_sequence<Is...>,
+    TVisitor&& visitor, TVariant&& variant, TExtras&&... extras) {
+  return apply_multi_visitor_dispatchable<num_variants>(
+      visitor, as_dispatchable(variant),
+      as_dispatchable_if<(Is + 1 < num_variants)>(extras)...);
+}
+}
+
+template <size_t num_variants, typename TVisitor, typename TVariant, typename... TExtras>
+decltype(auto) apply_multi_visitor(
+    TVisitor&& visitor, TVariant&& variant, TExtras&&... extras) {
+  return apply_multi_visitor_converted<num_variants>(
+      std::index_sequence_for<TExtras...>{}, visitor, variant, extras...);
+}
+
+
+// Curried multi visitation:
+//
+// In a nested loop, apply_multi_visitor dispatches the outer variant
+// again for every inner variant. bind_first dispatches the first variant
+// once and returns a callable bound to its alternative (one row of the
+// dispatch space), so that calling it only dispatches on the remaining
+// variants, whose types are given explicitly:
+//
+// for (auto& a : my_as) {
+//   auto fs_a = bind_first<BPtr>(fs, a);
+//   for (auto& b : my_bs) {
+//     fs_a(b);
+//   }
+// }
+//
+// Rows keep the visitor's dispatch mode: a symmetric visitor's row
+// reads the upper triangle, swapping the arguments as needed, and a
+// sparse visitor's row only searches the cases starting with the bound
+// alternative, falling back to visit_default.
+//
+// The returned callable holds a reference to the multi visitor and the
+// pointee of the bound variant, so it must not outlive either of them.
+// For a sparse visitor it also holds a copy of the bound variant, which
+// visit_default receives.
+template <typename TMultiVisitor, typename TVariant, typename... TRest>
+class BoundMultiVisitor {
+ public:
+  static_assert(sizeof...(TRest) >= 1,
+                "bind_first needs at least one remaining variant type");
+
+  using result_type = decltype(apply_multi_visitor<1 + sizeof...(TRest)>(
+      std::declval<TMultiVisitor&>(),
+      std::declval<const TVariant&>(),
+      std::declval<const TRest&>()...));
+
+  BoundMultiVisitor(TMultiVisitor& multi_visitor, const TVariant& variant) :
+      multi_visitor_(multi_visitor),
+      bound_(bind(variant)),
+      row_(rows[variant.type_index()]) {}
+
+  result_type operator()(const TRest&... rest) const {
+    return row_(multi_visitor_, bound_, rest...);
+  }
+
+ private:
+  using mode = typename multi_dispatch_mode<
+    typename std::decay<TMultiVisitor>::type, 1 + sizeof...(TRest),
+    TVariant, TRest...>::type;
+
+  static constexpr bool is_sparse =
+      std::is_same<mode, sparse_multi_dispatch>::value;
+
+  // What a row needs of the bound variant
+  using bound_type = typename std::conditional<
+    is_sparse, TVariant, void*>::type;
+
+  using row_type = result_type (*)(
+      TMultiVisitor&, const bound_type&, const TRest&...);
+
+  static bound_type bind(const TVariant& variant) {
+    if constexpr (is_sparse) {
+      return variant;
+    }
+    else {
+      return variant.get();
+    }
+  }
+
+  // The row of the bound variant's alternative I
+  template <size_t I>
+  static result_type visit_row(
+      TMultiVisitor& multi_visitor, const bound_type& bound,
+      const TRest&... rest) {
+    if constexpr (std::is_same<mode, symmetric_multi_dispatch>::value) {
+      return visit_symmetric_row<I>(multi_visitor, bound, rest...);
+    }
+    else if constexpr (is_sparse) {
+      return visit_sparse_row<I>(multi_visitor, bound, rest...);
+    }
+    else {
+      using A = typename TVariant::template type<I>;
+      BindVisitor<TMultiVisitor, A> bind_visitor {
+        multi_visitor, *static_cast<A*>(bound) };
+      return apply_multi_visitor<sizeof...(TRest)>(bind_visitor, rest...);
+    }
+  }
+
+  template <size_t I>
+  static result_type visit_symmetric_row(
+      TMultiVisitor& multi_visitor, void* ptr, const TVariant& other) {
+    constexpr size_t n = TVariant::num_types;
+    using table = symmetric_table<
+      TMultiVisitor, TVariant, std::make_index_sequence<n * (n + 1) / 2>>;
+    size_t j = other.type_index();
+    if (I <= j) {
+      return table::thunks[triangle_index(I, j, n)](
+          multi_visitor, ptr, other.get());
+    }
+    else {
+      return table::thunks[triangle_index(j, I, n)](
+          multi_visitor, other.get(), ptr);
+    }
+  }
+
+  template <size_t I>
+  static result_type visit_sparse_row(
+      TMultiVisitor& multi_visitor, const TVariant& bound,
+      const TRest&... rest) {
+    using cases = typename TMultiVisitor::sparse_cases;
+    using table = sparse_table<
+      TMultiVisitor, cases,
+      std::make_index_sequence<case_list_size<cases>::value>,
+      TVariant, TRest...>;
+    constexpr size_t first = table::lower_position(I * table::row_stride);
+    constexpr size_t last = table::lower_position((I + 1) * table::row_stride);
+    size_t key = I;
+    ((key = key * TRest::num_types + rest.type_index()), ...);
+    return table::dispatch_in(first, last, key, multi_visitor, bound, rest...);
+  }
+
+  template <size_t... Is>
+  static constexpr std::array<row_type, sizeof...(Is)> make_rows(
+      std::index_sequence<Is...>) {
+    return { &visit_row<Is>... };
+  }
+
+  static constexpr std::array<row_type, TVariant::num_types> rows =
+      make_rows(std::make_index_sequence<TVariant::num_types>{});
+
+  TMultiVisitor& multi_visitor_;
+  bound_type bound_;
+  row_type row_;
+};
+
+template <typename... TRest, typename TMultiVisitor, typename TVariant>
+BoundMultiVisitor<typename std::remove_reference<TMultiVisitor>::type,
+                  TVariant, TRest...>
+bind_first(TMultiVisitor&& multi_visitor, const TVariant& variant) {
+  return { multi_visitor, variant };
+}
+
+// Wire ids:
+//
+// Protocols number their message types on the wire, usually sparsely
+// and not in the order of any type list. wire_dispatch maps those ids to
+// alternatives at compile time and visits a raw payload directly:
+//
+// using Messages = wire_dispatch<
+//   wire_type<0x10, const Login>,
+//   wire_type<0x2a, const Logout>>;
+// Messages::visit(frame.id, frame.payload, handler);
+//
+// Small ids are looked up in a flat table, larger ones by a binary
+// search over the sorted ids. visit throws std::out_of_range for ids
+// that are not registered; index_of_wire_id returns -1 for them.
+template <size_t wire_id, typename T>
+struct wire_type {};
+
+namespace {
+// keys[i] as the key of case i
+template <size_t N>
+constexpr sparse_keys<N> numbered_keys(std::array<size_t, N> keys) {
+  sparse_keys<N> numbered {};
+  for (size_t i = 0; i < N; ++i) {
+    numbered.keys[i] = keys[i];
+    numbered.cases[i] = i;
+  }
+  return numbered;
+}
+
+// Maps every key below size to its case, and the others to -1
+template <size_t size, size_t N>
+constexpr std::array<size_t, size> flat_key_table(const sparse_keys<N>& sorted) {
+  std::array<size_t, size> table {};
+  for (size_t& entry : table) {
+    entry = -1;
+  }
+  for (size_t i = 0; i < N; ++i) {
+    if (sorted.keys[i] < size) {
+      table[sorted.keys[i]] = sorted.cases[i];
+    }
+  }
+  return table;
+}
+}
+
+template <typename... TWireTypes>
+class wire_dispatch;
+
+template <size_t... wire_ids, typename... Ts>
+class wire_dispatch<wire_type<wire_ids, Ts>...> {
+ public:
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  // The alternative at position I of Ts...
+  template <size_t I>
+  using type = type_at<I, Ts...>;
+
+  // Position of the alternative registered for wire_id, or -1
+  static constexpr size_t index_of_wire_id(size_t wire_id) {
+    if constexpr (use_flat_table) {
+      return wire_id < flat.size() ? flat[wire_id] : size_t(-1);
+    }
+    else {
+      size_t first = 0;
+      size_t last = num_types;
+      while (first < last) {
+        size_t middle = first + (last - first) / 2;
+        if (sorted.keys[middle] < wire_id) {
+          first = middle + 1;
+        }
+        else {
+          last = middle;
+        }
+      }
+      if (first < num_types && sorted.keys[first] == wire_id) {
+        return sorted.cases[first];
+      }
+      return -1;
+    }
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  static decltype(auto) visit(size_t wire_id, const void* ptr,
+                              TVisitor&& visitor, TExtras&&... extras) {
+    size_t index = index_of_wire_id(wire_id);
+    if (index == size_t(-1)) {
+      throw std::out_of_range("wire_dispatch: unknown wire id");
+    }
+    return visit_by_index<Ts...>(index, ptr, visitor, extras...);
+  }
+
+ private:
+  static_assert(num_types >= 1, "wire_dispatch needs at least one type");
+
+  static constexpr sparse_keys<num_types> sorted = sort_sparse_keys(
+      numbered_keys<num_types>({ wire_ids... }));
+
+  static_assert(has_unique_keys(sorted),
+                "wire_dispatch has a duplicate wire id");
+
+  static constexpr size_t max_flat_table_size = 256;
+
+  static constexpr bool use_flat_table =
+      sorted.keys[num_types - 1] < max_flat_table_size;
+
+  static constexpr size_t flat_table_size =
+      use_flat_table ? sorted.keys[num_types - 1] + 1 : 0;
+
+  static constexpr std::array<size_t, flat_table_size> flat =
+      flat_key_table<flat_table_size>(sorted);
+};
+
+// Range visitation:
+//
+// Visiting a std::vector<variant_ptr<...>> dereferences every pointee,
+// and when the pointees are scattered across the heap each visit stalls
+// on a cache miss. The range functions below issue a prefetch for the
+// pointee of element i + prefetch_distance while element i is being
+// visited, so that the pointee is (hopefully) in cache by the time we
+// get to it.
+//
+// for_each_visit<16>(hands.begin(), hands.end(), get_description);
+//
+// A prefetch_distance of 0 disables prefetching.
+
+constexpr size_t default_prefetch_distance = 8;
+
+namespace {
+inline void prefetch_for_read(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(address, 0, 3);
+#else
+  (void)address;
+#endif
+}
+
+template <typename TVariant, typename = void>
+struct has_prefetch_address : std::false_type {};
+
+template <typename TVariant>
+struct has_prefetch_address<
+  TVariant,
+  std::void_t<decltype(std::declval<const TVariant&>().prefetch_address())>>
+    : std::true_type {};
+
+// An address inside the pointee that can be computed without touching
+// it. get() is, for everything that stores its type index outside the
+// pointee; others (e.g. intrusive_variant_ptr) provide prefetch_address.
+template <typename TVariant>
+const void* prefetch_address_of(const TVariant& variant) {
+  if constexpr (has_prefetch_address<TVariant>::value) {
+    return variant.prefetch_address();
+  }
+  else {
+    return variant.get();
+  }
+}
+
+template <size_t prefetch_distance, typename TIterator, typename TFunction>
+void prefetched_for_each(TIterator first, TIterator last, TFunction&& function) {
+  TIterator ahead = first;
+  for (size_t i = 0; i < prefetch_distance && ahead != last; ++i, ++ahead) {
+    prefetch_for_read(prefetch_address_of(*ahead));
+  }
+  for (; first != last; ++first) {
+    if (prefetch_distance > 0 && ahead != last) {
+      prefetch_for_read(prefetch_address_of(*ahead));
+      ++ahead;
+    }
+    function(*first);
+  }
+}
+}
+
+// Calls element.visit(visitor) for every element in [first, last)
+template <size_t prefetch_distance = default_prefetch_distance,
+          typename TIterator, typename TVisitor>
+void for_each_visit(TIterator first, TIterator last, TVisitor&& visitor) {
+  prefetched_for_each<prefetch_distance>(
+      first, last,
+      [&visitor](const auto& element) { element.visit(visitor); });
+}
+
+template <size_t prefetch_distance = default_prefetch_distance,
+          typename TContainer, typename TVisitor>
+void for_each_visit(const TContainer& container, TVisitor&& visitor) {
+  for_each_visit<prefetch_distance>(
+      std::begin(container), std::end(container), visitor);
+}
+
+// Writes element.visit(visitor) for every element in [first, last)
+// into out, and returns the output iterator past the last result
+template <size_t prefetch_distance = default_prefetch_distance,
+          typename TIterator, typename TOutputIterator, typename TVisitor>
+TOutputIterator visit_range(
+    TIterator first, TIterator last, TOutputIterator out, TVisitor&& visitor) {
+  prefetched_for_each<prefetch_distance>(
+      first, last,
+      [&visitor, &out](const auto& element) {
+        *out = element.visit(visitor);
+        ++out;
+      });
+  return out;
+}
+
+
+// Grouped visitation:
+//
+// visit_grouped buckets the elements of a range by their alternative
+// and then visits each bucket as one homogeneous run. A visitor may
+// take a whole run at once by providing visit_span overloads:
+//
+// struct Integrate {
+//    void visit_span(span<Particle> particles);   // contiguous objects
+//    void visit_span(span<Particle*> particles);  // scattered objects
+//    void visit(Rigidbody& body);                 // one at a time
+// };
+//
+// For each alternative U, the run is passed as
+// - span<U> if the visitor accepts it and the objects of the run are
+//   laid out contiguously (e.g. they come from the same arena),
+// - otherwise span<U*> if the visitor accepts it,
+// - otherwise span<U> for each maximal contiguous sub-run if the visitor
+//   only accepts span<U>,
+// - otherwise one visit(U&) call per element.
+//
+// Elements are visited in alternative order, not in range order.
+
+// Non-owning view over count consecutive T
+template <typename T>
+class span {
+ public:
+  span(T* data, size_t size) :
+      data_(data),
+      size_(size) {}
+
+  T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+  T& operator[](size_t idx) const { return data_[idx]; }
+
+ private:
+  T* data_;
+  size_t size_;
+};
+
+namespace {
+template <typename TVisitor, typename TSpan, typename = void>
+struct has_visit_span : std::false_type {};
+
+template <typename TVisitor, typename TSpan>
+struct has_visit_span<
+  TVisitor, TSpan,
+  std::void_t<decltype(
+      std::declval<TVisitor&>().visit_span(std::declval<TSpan>()))>>
+    : std::true_type {};
+
+template <typename U>
+bool is_contiguous_run(U* const* pointers, size_t count) {
+  for (size_t i = 1; i < count; ++i) {
+    if (pointers[i] != pointers[0] + i) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Dispatch on (accepts span<U>, accepts span<U*>)
+template <typename U, typename TVisitor>
+void visit_run_impl(TVisitor& visitor, U** pointers, size_t count,
+                    std::true_type, std::true_type) {
+  if (is_contiguous_run(pointers, count)) {
+    visitor.visit_span(span<U>(pointers[0], count));
+  }
+  else {
+    visitor.visit_span(span<U*>(pointers, count));
+  }
+}
+
+template <typename U, typename TVisitor>
+void visit_run_impl(TVisitor& visitor, U** pointers, size_t count,
+                    std::true_type, std::false_type) {
+  size_t run_begin = 0;
+  for (size_t i = 1; i <= count; ++i) {
+    if (i == count || pointers[i] != pointers[i - 1] + 1) {
+      visitor.visit_span(span<U>(pointers[run_begin], i - run_begin));
+      run_begin = i;
+    }
+  }
+}
+
+template <typename U, typename TVisitor>
+void visit_run_impl(TVisitor& visitor, U** pointers, size_t count,
+                    std::false_type, std::true_type) {
+  visitor.visit_span(span<U*>(pointers, count));
+}
+
+template <typename U, typename TVisitor>
+void visit_run_impl(TVisitor& visitor, U** pointers, size_t count,
+                    std::false_type, std::false_type) {
+  for (size_t i = 0; i < count; ++i) {
+    visitor.visit(*pointers[i]);
+  }
+}
+
+// Visits count objects of the same alternative U
+template <typename U, typename TVisitor>
+void visit_run(TVisitor& visitor, U** pointers, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  visit_run_impl(visitor, pointers, count,
+                 has_visit_span<TVisitor, span<U>>{},
+                 has_visit_span<TVisitor, span<U*>>{});
+}
+
+template <typename TVariant>
+struct grouped_visitation;
+
+template <typename... Ts>
+struct grouped_visitation<variant_ptr<Ts...>> {
+  using buckets_type = std::tuple<std::vector<Ts*>...>;
+
+  struct BucketCollector {
+    buckets_type& buckets;
+
+    template <typename U>
+    void visit(U& u) {
+      std::get<index_of_type<U, Ts...>::value>(buckets).push_back(&u);
+    }
+  };
+
+  template <typename TIterator, typename TVisitor>
+  static void run(TIterator first, TIterator last, TVisitor& visitor) {
+    buckets_type buckets;
+    BucketCollector collector { buckets };
+    for (; first != last; ++first) {
+      first->visit(collector);
+    }
+    visit_buckets(visitor, buckets, std::index_sequence_for<Ts...>{});
+  }
+
+  template <typename TVisitor, size_t... Is>
+  static void visit_buckets(TVisitor& visitor, buckets_type& buckets,
+                            std::index_sequence<Is...>) {
+    (visit_run(visitor,
+               std::get<Is>(buckets).data(),
+               std::get<Is>(buckets).size()), ...);
+  }
+};
+}
+
+template <typename TIterator, typename TVisitor>
+void visit_grouped(TIterator first, TIterator last, TVisitor&& visitor) {
+  using variant_type = typename std::decay<decltype(*first)>::type;
+  grouped_visitation<variant_type>::run(first, last, visitor);
+}
+
+template <typename TContainer, typename TVisitor>
+void visit_grouped(const TContainer& container, TVisitor&& visitor) {
+  visit_grouped(std::begin(container), std::end(container), visitor);
+}
+
+
+// Visitor fusion:
+//
+// Running several independent passes over the same range pays for the
+// dispatch and the pointee dereference once per pass. A FusedVisitor
+// dispatches once and then calls every wrapped visitor on the resolved
+// alternative, in order, returning a std::tuple of their results.
+//
+// auto results = visit_fused(hand, get_description, get_score);
+// for_each_visit(hands, fuse_visitors(update, render, audit));
+//
+// Visitors that return void contribute a void_result to the tuple.
+
+namespace {
+template <typename TVisitor, typename U, typename... TExtras>
+auto fused_visit_one(TVisitor& visitor, U& u, TExtras&... extras)
+    -> typename std::enable_if<
+      !std::is_void<decltype(visitor.visit(u, extras...))>::value,
+      decltype(visitor.visit(u, extras...))>::type {
+  return visitor.visit(u, extras...);
+}
+
+template <typename TVisitor, typename U, typename... TExtras>
+auto fused_visit_one(TVisitor& visitor, U& u, TExtras&... extras)
+    -> typename std::enable_if<
+      std::is_void<decltype(visitor.visit(u, extras...))>::value,
+      void_result>::type {
+  visitor.visit(u, extras...);
+  return void_result {};
+}
+}
+
+// FusedVisitor holds references to the fused visitors, so it must not
+// outlive them
+template <typename... TVisitors>
+class FusedVisitor {
+ public:
+  FusedVisitor(TVisitors&... visitors) :
+      visitors_(visitors...) {}
+
+  template <typename U, typename... TExtras>
+  auto visit(U& u, TExtras&&... extras) {
+    return visit_all(u, std::index_sequence_for<TVisitors...>{}, extras...);
+  }
+
+ private:
+  template <typename U, size_t... Is, typename... TExtras>
+  auto visit_all(U& u, std::index_sequence<Is...>, TExtras&... extras) {
+    using result_type = std::tuple<
+      decltype(fused_visit_one(std::get<Is>(visitors_), u, extras...))...>;
+    // Braced initialization evaluates the visitors left to right
+    return result_type {
+      fused_visit_one(std::get<Is>(visitors_), u, extras...)... };
+  }
+
+  std::tuple<TVisitors&...> visitors_;
+};
+
+template <typename... TVisitors>
+FusedVisitor<typename std::remove_reference<TVisitors>::type...>
+fuse_visitors(TVisitors&&... visitors) {
+  return { visitors... };
+}
+
+template <typename TVariant, typename... TVisitors>
+decltype(auto) visit_fused(const TVariant& variant, TVisitors&&... visitors) {
+  return variant.visit(fuse_visitors(visitors...));
+}
+
 }
 
 #endif /* _LIUS_TOOLS_VARIANT_PTR_H_ */
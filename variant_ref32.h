@@ -0,0 +1,223 @@
+#ifndef _LIUS_TOOLS_VARIANT_REF32_H_
+#define _LIUS_TOOLS_VARIANT_REF32_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "variant_ptr.h"
+
+namespace lius_tools {
+
+// 32 bit variant references:
+//
+// On 64 bit machines a variant_ptr takes 16 bytes, which in pointer
+// heavy graphs means the edges take more room than the nodes. When
+// every alternative lives in its own pool, an edge only needs to name
+// the pool and a slot inside it. A variant_ref32 packs both into 32 bits:
+//
+//   low tag_bits bits:  type index (just enough bits for Ts...)
+//   remaining bits:     slot inside the pool of that alternative
+//
+// so with 4 alternatives, each pool can hold 2^30 objects. The pools
+// are owned by a variant_pools<Ts...>, which creates the references and
+// resolves them:
+//
+// variant_pools<Leaf, Node> pools;
+// variant_ref32<Leaf, Node> leaf = pools.emplace<Leaf>(3);
+// pools.visit(leaf, my_visitor);
+// apply_multi_visitor<2>(my_multi_visitor,
+//                        pools.resolve(a), pools.resolve(b));
+//
+// References stay valid when a pool grows, pointers returned by
+// resolve do not.
+
+namespace {
+constexpr size_t bits_for(size_t count) {
+  size_t bits = 0;
+  while ((size_t(1) << bits) < count) {
+    ++bits;
+  }
+  return bits;
+}
+}
+
+template <typename... Ts>
+class variant_ref32 {
+ public:
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  static constexpr size_t tag_bits = bits_for(num_types);
+
+  static constexpr size_t slot_bits = 32 - tag_bits;
+
+  // One past the largest slot a reference can name
+  static constexpr size_t max_slots = size_t(1) << slot_bits;
+
+  static_assert(tag_bits < 32, "too many alternatives for variant_ref32");
+
+  // The alternative at position I of Ts...
+  template <size_t I>
+  using type = type_at<I, Ts...>;
+
+  variant_ref32(size_t type_index, size_t slot) :
+      word_(std::uint32_t(slot << tag_bits | type_index)) {}
+
+  // Position of X inside Ts...
+  template <typename X>
+  static constexpr size_t index_of() {
+    return index_of_type<X, Ts...>::value;
+  }
+
+  template <typename X>
+  bool has_type() const {
+    constexpr bool is_x[] = { std::is_same<X, Ts>::value... };
+    return is_x[type_index()];
+  }
+
+  // Position of the referenced object's type inside Ts...
+  size_t type_index() const {
+    return word_ & ((std::uint32_t(1) << tag_bits) - 1);
+  }
+
+  // Position of the referenced object inside the pool of its type
+  size_t slot() const {
+    return word_ >> tag_bits;
+  }
+
+  bool operator==(const variant_ref32& other) const {
+    return word_ == other.word_;
+  }
+
+  bool operator!=(const variant_ref32& other) const {
+    return word_ != other.word_;
+  }
+
+ private:
+  std::uint32_t word_;
+};
+
+// One std::vector per alternative, addressed by variant_ref32<Ts...>
+template <typename... Ts>
+class variant_pools {
+ public:
+  using ref_type = variant_ref32<Ts...>;
+
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  variant_pools() = default;
+
+  // The copy gets pools of its own, so it points data_ at those
+  variant_pools(const variant_pools& other) :
+      pools_(other.pools_) {
+    refresh_data();
+  }
+
+  variant_pools(variant_pools&& other) noexcept :
+      pools_(std::move(other.pools_)) {
+    refresh_data();
+    other.refresh_data();
+  }
+
+  variant_pools& operator=(variant_pools other) noexcept {
+    std::swap(pools_, other.pools_);
+    refresh_data();
+    return *this;
+  }
+
+  // Constructs an X at the end of its pool and returns a reference to it
+  template <typename X, typename... TArgs>
+  ref_type emplace(TArgs&&... args) {
+    constexpr size_t index = index_of_type<X, Ts...>::value;
+    static_assert(index != size_t(-1),
+                  "X is not one of the alternatives of these pools");
+    std::vector<X>& pool = std::get<index>(pools_);
+    if (pool.size() >= ref_type::max_slots) {
+      throw std::length_error("variant_pools: pool is full");
+    }
+    pool.emplace_back(std::forward<TArgs>(args)...);
+    data_[index] = pool.data();
+    return ref_type(index, pool.size() - 1);
+  }
+
+  // Reserves room for n objects of alternative X, so that emplacing up
+  // to n of them does not move the pool
+  template <typename X>
+  void reserve(size_t n) {
+    constexpr size_t index = index_of_type<X, Ts...>::value;
+    std::get<index>(pools_).reserve(n);
+    data_[index] = std::get<index>(pools_).data();
+  }
+
+  // All objects of alternative X, contiguous. A span rather than the
+  // vector, which could be reallocated behind data_.
+  template <typename X>
+  span<X> pool() {
+    std::vector<X>& pool = std::get<index_of_type<X, Ts...>::value>(pools_);
+    return span<X>(pool.data(), pool.size());
+  }
+
+  template <typename X>
+  span<const X> pool() const {
+    const std::vector<X>& pool =
+        std::get<index_of_type<X, Ts...>::value>(pools_);
+    return span<const X>(pool.data(), pool.size());
+  }
+
+  // Address of the referenced object, until its pool grows
+  void* get(ref_type ref) const {
+    return static_cast<char*>(data_[ref.type_index()]) +
+        ref.slot() * sizes[ref.type_index()];
+  }
+
+  // The reference already carries the type index, so this needs no
+  // dispatch
+  variant_ptr<Ts...> resolve(ref_type ref) {
+    return variant_ptr_access<variant_ptr<Ts...>>::make(
+        get(ref), ref.type_index());
+  }
+
+  variant_ptr<const Ts...> resolve(ref_type ref) const {
+    return variant_ptr_access<variant_ptr<const Ts...>>::make(
+        get(ref), ref.type_index());
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  decltype(auto) visit(
+      ref_type ref, TVisitor&& visitor, TExtras&&... extras) {
+    return visit_dispatch<Ts...>::visit(
+        ref.type_index(), get(ref), visitor, extras...);
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  decltype(auto) visit(
+      ref_type ref, TVisitor&& visitor, TExtras&&... extras) const {
+    return visit_dispatch<const Ts...>::visit(
+        ref.type_index(), get(ref), visitor, extras...);
+  }
+
+ private:
+  static constexpr size_t sizes[] = { sizeof(Ts)... };
+
+  void refresh_data() {
+    refresh_data(std::index_sequence_for<Ts...>{});
+  }
+
+  template <size_t... Is>
+  void refresh_data(std::index_sequence<Is...>) {
+    ((data_[Is] = std::get<Is>(pools_).data()), ...);
+  }
+
+  std::tuple<std::vector<Ts>...> pools_;
+
+  // pools_'s data() pointers, so that get() needs no dispatch
+  std::array<void*, sizeof...(Ts)> data_ = {};
+};
+
+}
+
+#endif /* _LIUS_TOOLS_VARIANT_REF32_H_ */
@@ -0,0 +1,362 @@
+#ifndef _LIUS_TOOLS_VARIANT_SERIALIZE_H_
+#define _LIUS_TOOLS_VARIANT_SERIALIZE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "variant_ptr.h"
+#include "variant_ref32.h"
+
+namespace lius_tools {
+
+// Binary serialization:
+//
+// variant_writer<Ts...> streams a collection of variant_ptrs to a
+// std::ostream, grouped by alternative, and variant_reader<Ts...> reads
+// them back from a buffer (e.g. a mapped file):
+//
+// variant_writer<Rock, Paper> writer(file);
+// writer.write(hands);
+// ...
+// variant_reader<Rock, Paper> reader(mapped_bytes, mapped_size);
+// reader.visit_groups(my_visitor);       // zero-copy where possible
+// reader.materialize(pools);             // copies into variant_pools
+//
+// The stream is a header followed by any number of groups, one per
+// alternative per write() call, in host byte order:
+//
+//   header: "VPS1", uint32 number of alternatives,
+//           uint64 hash of the alternatives' sizes and alignments
+//   group:  uint32 type index, uint32 flags, uint64 element count,
+//           uint64 payload bytes, uint64 reserved,
+//           payload, zero padding up to a multiple of 16 bytes
+//
+// Alternatives are serialized by variant_serializer<T>. Trivially
+// copyable types default to a raw copy of their bytes, which the reader
+// can hand out in place without copying as long as the buffer is 16 byte
+// aligned. Other types must specialize it:
+//
+// template <>
+// struct variant_serializer<Name> {
+//   static constexpr bool raw = false;
+//   static void write(std::ostream& out, const Name& name);
+//   static Name read(const char*& data, const char* end);
+// };
+//
+// read advances data past what it consumed, and throws (e.g. through
+// read_value) if it would read past end. The reader rejects a group
+// whose elements do not end exactly at the end of its payload.
+//
+// Elements come back grouped by alternative, not in their original
+// order.
+template <typename T, typename = void>
+struct variant_serializer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "T is not trivially copyable; specialize variant_serializer "
+                "for it");
+  static constexpr bool raw = true;
+};
+
+// Helpers for variant_serializer specializations
+template <typename T>
+void write_value(std::ostream& out, const T& value) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "write_value needs a trivially copyable type");
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T read_value(const char*& data, const char* end) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "read_value needs a trivially copyable type");
+  if (size_t(end - data) < sizeof(T)) {
+    throw std::runtime_error("variant_reader: truncated element");
+  }
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  data += sizeof(T);
+  return value;
+}
+
+namespace {
+constexpr char serialize_magic[4] = { 'V', 'P', 'S', '1' };
+
+constexpr size_t serialize_alignment = 16;
+
+constexpr std::uint32_t raw_group_flag = 1;
+
+struct serialized_header {
+  char magic[4];
+  std::uint32_t num_types;
+  std::uint64_t layout_hash;
+};
+
+struct serialized_group {
+  std::uint32_t type_index;
+  std::uint32_t flags;
+  std::uint64_t count;
+  std::uint64_t byte_size;
+  std::uint64_t reserved;
+};
+
+static_assert(sizeof(serialized_group) % serialize_alignment == 0,
+              "payloads must start aligned");
+
+template <typename T>
+constexpr bool is_raw_serialized() {
+  return variant_serializer<T>::raw;
+}
+
+// FNV-1a over the size, alignment and serialization kind of Ts..., so
+// that a reader built for different types rejects the stream
+template <typename... Ts>
+constexpr std::uint64_t layout_hash() {
+  constexpr std::uint64_t fields[] = {
+    std::uint64_t(sizeof(Ts) << 16 | alignof(Ts) << 1 |
+                  is_raw_serialized<Ts>())... };
+  std::uint64_t hash = 14695981039346656037ull;
+  for (std::uint64_t field : fields) {
+    hash = (hash ^ field) * 1099511628211ull;
+  }
+  return hash;
+}
+
+inline size_t padding_for(size_t size) {
+  return (serialize_alignment - size % serialize_alignment) %
+      serialize_alignment;
+}
+}
+
+template <typename... Ts>
+class variant_writer {
+ public:
+  // Writes the header
+  explicit variant_writer(std::ostream& out) :
+      out_(out) {
+    serialized_header header = {
+      { serialize_magic[0], serialize_magic[1],
+        serialize_magic[2], serialize_magic[3] },
+      std::uint32_t(sizeof...(Ts)),
+      layout_hash<Ts...>() };
+    out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  // Writes one group per alternative present in [first, last), whose
+  // elements are variant_ptr<Ts...> or variant_ptr<const Ts...>
+  template <typename TIterator>
+  void write(TIterator first, TIterator last) {
+    GroupWriter group_writer { out_ };
+    visit_grouped(first, last, group_writer);
+  }
+
+  template <typename TContainer>
+  void write(const TContainer& container) {
+    write(std::begin(container), std::end(container));
+  }
+
+ private:
+  struct GroupWriter {
+    std::ostream& out;
+
+    // Contiguous raw elements go out in a single write
+    template <typename U>
+    void visit_span(span<U> run) {
+      using T = typename std::remove_const<U>::type;
+      if constexpr (is_raw_serialized<T>()) {
+        write_group<T>(run.size(), reinterpret_cast<const char*>(run.data()),
+                       run.size() * sizeof(T));
+      }
+      else {
+        std::ostringstream payload;
+        for (const T& t : run) {
+          variant_serializer<T>::write(payload, t);
+        }
+        write_group<T>(run.size(), payload.str());
+      }
+    }
+
+    template <typename U>
+    void visit_span(span<U*> run) {
+      using T = typename std::remove_const<U>::type;
+      if constexpr (is_raw_serialized<T>()) {
+        std::string payload(run.size() * sizeof(T), '\0');
+        for (size_t i = 0; i < run.size(); ++i) {
+          std::memcpy(&payload[i * sizeof(T)], run[i], sizeof(T));
+        }
+        write_group<T>(run.size(), payload);
+      }
+      else {
+        std::ostringstream payload;
+        for (const T* t : run) {
+          variant_serializer<T>::write(payload, *t);
+        }
+        write_group<T>(run.size(), payload.str());
+      }
+    }
+
+    template <typename T>
+    void write_group(size_t count, const std::string& payload) {
+      write_group<T>(count, payload.data(), payload.size());
+    }
+
+    template <typename T>
+    void write_group(size_t count, const char* payload, size_t byte_size) {
+      constexpr size_t index = index_of_type<T, Ts...>::value;
+      static_assert(index != size_t(-1),
+                    "T is not one of the alternatives of this writer");
+      serialized_group group = {
+        std::uint32_t(index),
+        is_raw_serialized<T>() ? raw_group_flag : 0,
+        std::uint64_t(count),
+        std::uint64_t(byte_size),
+        0 };
+      out.write(reinterpret_cast<const char*>(&group), sizeof(group));
+      out.write(payload, byte_size);
+      const char zeros[serialize_alignment] = {};
+      out.write(zeros, padding_for(byte_size));
+    }
+  };
+
+  std::ostream& out_;
+};
+
+// Reads a stream written by variant_writer<Ts...> from a buffer, which
+// must outlive the reader and the spans it hands out. Throws
+// std::runtime_error if the buffer is not such a stream.
+template <typename... Ts>
+class variant_reader {
+ public:
+  variant_reader(const void* data, size_t size) :
+      begin_(static_cast<const char*>(data)),
+      end_(begin_ + size) {
+    serialized_header header;
+    if (size < sizeof(header)) {
+      throw std::runtime_error("variant_reader: truncated header");
+    }
+    std::memcpy(&header, begin_, sizeof(header));
+    if (std::memcmp(header.magic, serialize_magic, 4) != 0) {
+      throw std::runtime_error("variant_reader: bad magic");
+    }
+    if (header.num_types != sizeof...(Ts) ||
+        header.layout_hash != layout_hash<Ts...>()) {
+      throw std::runtime_error(
+          "variant_reader: stream was written for other alternatives");
+    }
+  }
+
+  // Visits every element, group by group. For raw alternatives the
+  // visitor receives the elements in place, as one span<const U> per
+  // group if it provides visit_span(span<const U>) and one
+  // visit(const U&) per element otherwise. Other alternatives are
+  // decoded one element at a time and passed to visit(U&).
+  template <typename TVisitor>
+  void visit_groups(TVisitor&& visitor) const {
+    for_each_group([&visitor](const serialized_group& group,
+                              const char* payload) {
+      group_table<TVisitor>::visit[group.type_index](visitor, group, payload);
+    });
+  }
+
+  // Copies every element into pools and returns their references, in
+  // stream order
+  std::vector<variant_ref32<Ts...>> materialize(
+      variant_pools<Ts...>& pools) const {
+    Materializer materializer { pools, {} };
+    visit_groups(materializer);
+    return std::move(materializer.refs);
+  }
+
+ private:
+  template <typename TFunction>
+  void for_each_group(TFunction&& function) const {
+    const char* cursor = begin_ + sizeof(serialized_header);
+    while (cursor != end_) {
+      serialized_group group;
+      if (size_t(end_ - cursor) < sizeof(group)) {
+        throw std::runtime_error("variant_reader: truncated group");
+      }
+      std::memcpy(&group, cursor, sizeof(group));
+      cursor += sizeof(group);
+      if (group.type_index >= sizeof...(Ts) ||
+          group.byte_size > std::uint64_t(end_ - cursor)) {
+        throw std::runtime_error("variant_reader: corrupt group");
+      }
+      function(group, cursor);
+      size_t byte_size = size_t(group.byte_size);
+      cursor += byte_size + std::min(padding_for(byte_size),
+                                     size_t(end_ - cursor) - byte_size);
+    }
+  }
+
+  template <typename TVisitor>
+  struct group_table {
+    using visitor_type = typename std::remove_reference<TVisitor>::type;
+
+    template <typename T>
+    static void visit_group(visitor_type& visitor,
+                            const serialized_group& group,
+                            const char* payload) {
+      size_t count = size_t(group.count);
+      if constexpr (is_raw_serialized<T>()) {
+        // Divides instead of multiplying, which a corrupt count could
+        // overflow
+        if (group.byte_size % sizeof(T) != 0 ||
+            group.count != group.byte_size / sizeof(T)) {
+          throw std::runtime_error("variant_reader: corrupt group");
+        }
+        if (reinterpret_cast<std::uintptr_t>(payload) % alignof(T) != 0) {
+          throw std::runtime_error("variant_reader: misaligned buffer");
+        }
+        const T* elements = reinterpret_cast<const T*>(payload);
+        if constexpr (has_visit_span<visitor_type, span<const T>>::value) {
+          visitor.visit_span(span<const T>(elements, count));
+        }
+        else {
+          for (size_t i = 0; i < count; ++i) {
+            visitor.visit(elements[i]);
+          }
+        }
+      }
+      else {
+        const char* cursor = payload;
+        const char* end = payload + group.byte_size;
+        for (size_t i = 0; i < count; ++i) {
+          T element = variant_serializer<T>::read(cursor, end);
+          visitor.visit(element);
+        }
+        if (cursor != end) {
+          throw std::runtime_error("variant_reader: corrupt group");
+        }
+      }
+    }
+
+    static constexpr void (*visit[])(visitor_type&, const serialized_group&,
+                                     const char*) = { &visit_group<Ts>... };
+  };
+
+  struct Materializer {
+    variant_pools<Ts...>& pools;
+    std::vector<variant_ref32<Ts...>> refs;
+
+    template <typename T>
+    void visit(const T& element) {
+      refs.push_back(pools.template emplace<T>(element));
+    }
+  };
+
+  const char* begin_;
+  const char* end_;
+};
+
+}
+
+#endif /* _LIUS_TOOLS_VARIANT_SERIALIZE_H_ */
@@ -0,0 +1,258 @@
+#ifndef _LIUS_TOOLS_VARIANT_SHARED_PTR_H_
+#define _LIUS_TOOLS_VARIANT_SHARED_PTR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "variant_ptr.h"
+
+namespace lius_tools {
+
+// Shared ownership:
+//
+// variant_ptr does not own its pointee, so keeping objects alive used to
+// take a parallel std::vector<std::shared_ptr<...>>. A variant_shared_ptr
+// owns its pointee with a reference count, and is laid out like a
+// variant_ptr (pointer and type index, two words):
+//
+// using HandPtr = variant_shared_ptr<Rock, Paper, Scissors>;
+// HandPtr hand = HandPtr::make<Paper>();
+// hand.visit(get_description);
+// variant_ptr<Rock, Paper, Scissors> view = hand.ptr();
+//
+// The count lives in front of the object, in the same allocation, at an
+// offset that only depends on the object's type. The last owner destroys
+// the object through a table indexed by the type index, so the
+// alternatives need no common base or virtual destructor.
+//
+// The count is atomic by default. Graphs confined to one thread can use
+// local_variant_shared_ptr, whose count is a plain integer.
+
+// Reference count policies
+struct atomic_refcount {
+  using count_type = std::atomic<size_t>;
+
+  static void increment(count_type& count) {
+    count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Returns whether this was the last reference
+  static bool decrement(count_type& count) {
+    return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+
+  static size_t load(const count_type& count) {
+    return count.load(std::memory_order_relaxed);
+  }
+};
+
+struct local_refcount {
+  using count_type = size_t;
+
+  static void increment(count_type& count) {
+    ++count;
+  }
+
+  static bool decrement(count_type& count) {
+    return --count == 0;
+  }
+
+  static size_t load(const count_type& count) {
+    return count;
+  }
+};
+
+namespace {
+// Where X starts in an allocation that begins with a count_type
+template <typename TCount, typename X>
+constexpr size_t shared_value_offset() {
+  size_t alignment = alignof(X);
+  return (sizeof(TCount) + alignment - 1) / alignment * alignment;
+}
+
+template <typename TCount, typename X>
+constexpr size_t shared_block_alignment() {
+  return alignof(X) > alignof(TCount) ? alignof(X) : alignof(TCount);
+}
+
+template <typename TCount, typename... Ts>
+struct shared_block {
+  static TCount& count(void* ptr, size_t type_index) {
+    static constexpr size_t offsets[] = {
+      shared_value_offset<TCount, Ts>()... };
+    return *reinterpret_cast<TCount*>(
+        static_cast<char*>(ptr) - offsets[type_index]);
+  }
+
+  // Returns the address of the new X, whose count is 1
+  template <typename X, typename... TArgs>
+  static void* create(TArgs&&... args) {
+    using value_type = typename std::remove_const<X>::type;
+    constexpr size_t offset = shared_value_offset<TCount, X>();
+    constexpr std::align_val_t alignment {
+      shared_block_alignment<TCount, X>() };
+    char* block = static_cast<char*>(
+        ::operator new(offset + sizeof(X), alignment));
+    TCount* count = new (block) TCount(1);
+    try {
+      return new (block + offset) value_type(std::forward<TArgs>(args)...);
+    }
+    catch (...) {
+      count->~TCount();
+      ::operator delete(block, alignment);
+      throw;
+    }
+  }
+
+  template <typename X>
+  static void destroy_as(void* ptr) {
+    using value_type = typename std::remove_const<X>::type;
+    constexpr size_t offset = shared_value_offset<TCount, X>();
+    constexpr std::align_val_t alignment {
+      shared_block_alignment<TCount, X>() };
+    char* block = static_cast<char*>(ptr) - offset;
+    static_cast<value_type*>(ptr)->~value_type();
+    reinterpret_cast<TCount*>(block)->~TCount();
+    ::operator delete(block, alignment);
+  }
+
+  static void destroy(void* ptr, size_t type_index) {
+    static constexpr void (*table[])(void*) = { &destroy_as<Ts>... };
+    table[type_index](ptr);
+  }
+};
+}
+
+template <typename TPolicy, typename... Ts>
+class basic_variant_shared_ptr {
+ public:
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  // The alternative at position I of Ts...
+  template <size_t I>
+  using type = type_at<I, Ts...>;
+
+  // Constructs an X owned by a new basic_variant_shared_ptr
+  template <typename X, typename... TArgs>
+  static basic_variant_shared_ptr make(TArgs&&... args) {
+    constexpr size_t index = index_of_type<X, Ts...>::value;
+    static_assert(index != size_t(-1),
+                  "X is not one of the alternatives of this "
+                  "variant_shared_ptr");
+    return basic_variant_shared_ptr(
+        block_type::template create<type_at<index, Ts...>>(
+            std::forward<TArgs>(args)...),
+        index);
+  }
+
+  // Owns nothing
+  basic_variant_shared_ptr() :
+      ptr_(nullptr),
+      type_index_(0) {}
+
+  basic_variant_shared_ptr(std::nullptr_t) :
+      basic_variant_shared_ptr() {}
+
+  basic_variant_shared_ptr(const basic_variant_shared_ptr& other) :
+      ptr_(other.ptr_),
+      type_index_(other.type_index_) {
+    if (ptr_ != nullptr) {
+      TPolicy::increment(count());
+    }
+  }
+
+  basic_variant_shared_ptr(basic_variant_shared_ptr&& other) noexcept :
+      ptr_(other.ptr_),
+      type_index_(other.type_index_) {
+    other.ptr_ = nullptr;
+  }
+
+  basic_variant_shared_ptr& operator=(basic_variant_shared_ptr other) noexcept {
+    std::swap(ptr_, other.ptr_);
+    std::swap(type_index_, other.type_index_);
+    return *this;
+  }
+
+  ~basic_variant_shared_ptr() {
+    reset();
+  }
+
+  void reset() {
+    if (ptr_ != nullptr && TPolicy::decrement(count())) {
+      block_type::destroy(ptr_, type_index_);
+    }
+    ptr_ = nullptr;
+  }
+
+  explicit operator bool() const {
+    return ptr_ != nullptr;
+  }
+
+  // Number of owners of the pointee, 0 if there is none
+  size_t use_count() const {
+    return ptr_ != nullptr ? TPolicy::load(count()) : 0;
+  }
+
+  // A non-owning view, valid as long as some owner is alive
+  variant_ptr<Ts...> ptr() const {
+    return variant_ptr_access<variant_ptr<Ts...>>::make(ptr_, type_index_);
+  }
+
+  // Position of X inside Ts...
+  template <typename X>
+  static constexpr size_t index_of() {
+    return index_of_type<X, Ts...>::value;
+  }
+
+  template <typename X>
+  bool has_type() const {
+    constexpr bool is_x[] = { std::is_same<X, Ts>::value... };
+    return is_x[type_index_];
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  decltype(auto) visit(
+      TVisitor&& visitor, TExtras&&... extras) const {
+    return visit_dispatch<Ts...>::visit(
+        type_index_, ptr_, visitor, extras...);
+  }
+
+  // The raw pointee, without any type information
+  void* get() const {
+    return ptr_;
+  }
+
+  // Position of the pointee's type inside Ts...
+  size_t type_index() const {
+    return type_index_;
+  }
+
+ private:
+  using block_type = shared_block<typename TPolicy::count_type, Ts...>;
+
+  basic_variant_shared_ptr(void* ptr, size_t type_index) :
+      ptr_(ptr),
+      type_index_(type_index) {}
+
+  typename TPolicy::count_type& count() const {
+    return block_type::count(ptr_, type_index_);
+  }
+
+  void* ptr_;
+  size_t type_index_;
+};
+
+template <typename... Ts>
+using variant_shared_ptr = basic_variant_shared_ptr<atomic_refcount, Ts...>;
+
+// For objects that are only ever shared within one thread
+template <typename... Ts>
+using local_variant_shared_ptr =
+    basic_variant_shared_ptr<local_refcount, Ts...>;
+
+}
+
+#endif /* _LIUS_TOOLS_VARIANT_SHARED_PTR_H_ */
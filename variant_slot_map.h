@@ -0,0 +1,349 @@
+#ifndef _LIUS_TOOLS_VARIANT_SLOT_MAP_H_
+#define _LIUS_TOOLS_VARIANT_SLOT_MAP_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "variant_ptr.h"
+#include "variant_ref32.h"
+
+namespace lius_tools {
+
+// Generational handles:
+//
+// A variant_ptr pins its pointee: the object can never move, so pools
+// that see many erasures fragment over time. A variant_handle instead
+// names a slot in a per-alternative slot map, which knows where the
+// object currently is, together with the generation of that slot:
+//
+//   32 bits: type index (low bits) and slot, like variant_ref32
+//   32 bits: generation of the slot when the handle was made
+//
+// Erasing an object bumps the generation of its slot, so handles to it
+// are detected as stale instead of silently naming whatever object
+// reuses the slot later.
+//
+// variant_slot_maps<Ship, Asteroid> world;
+// auto ship = world.emplace<Ship>(...);
+// world.visit(ship, my_visitor);
+// world.erase(ship);
+// world.contains(ship);  // false
+//
+// Each alternative's objects are kept in one dense array: erasing moves
+// the last object into the hole, so the arrays are compacted as they go
+// and whole alternatives can be visited contiguously with visit_all.
+// Handles stay valid across these moves, pointers into the arrays and
+// variant_ptrs returned by resolve do not.
+template <typename... Ts>
+class variant_handle {
+ public:
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  static constexpr size_t tag_bits = bits_for(num_types);
+
+  // One past the largest slot a handle can name
+  static constexpr size_t max_slots = size_t(1) << (32 - tag_bits);
+
+  static_assert(tag_bits < 32, "too many alternatives for variant_handle");
+
+  // The alternative at position I of Ts...
+  template <size_t I>
+  using type = type_at<I, Ts...>;
+
+  variant_handle(size_t type_index, size_t slot, std::uint32_t generation) :
+      index_(std::uint32_t(slot << tag_bits | type_index)),
+      generation_(generation) {}
+
+  // Position of X inside Ts...
+  template <typename X>
+  static constexpr size_t index_of() {
+    return index_of_type<X, Ts...>::value;
+  }
+
+  template <typename X>
+  bool has_type() const {
+    constexpr bool is_x[] = { std::is_same<X, Ts>::value... };
+    return is_x[type_index()];
+  }
+
+  // Position of the object's type inside Ts...
+  size_t type_index() const {
+    return index_ & ((std::uint32_t(1) << tag_bits) - 1);
+  }
+
+  // Slot of the object inside the slot map of its type
+  size_t slot() const {
+    return index_ >> tag_bits;
+  }
+
+  std::uint32_t generation() const {
+    return generation_;
+  }
+
+  bool operator==(const variant_handle& other) const {
+    return index_ == other.index_ && generation_ == other.generation_;
+  }
+
+  bool operator!=(const variant_handle& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  std::uint32_t index_;
+  std::uint32_t generation_;
+};
+
+// Objects of one type in a dense array, addressed through a table of
+// slots with O(1) insert, erase and lookup. Free slots form a linked
+// list through their dense index.
+template <typename T>
+class slot_map {
+ public:
+  static constexpr std::uint32_t no_slot = std::uint32_t(-1);
+
+  // Constructs a T and returns its (slot, generation)
+  template <typename... TArgs>
+  std::pair<size_t, std::uint32_t> emplace(TArgs&&... args) {
+    values_.emplace_back(std::forward<TArgs>(args)...);
+    size_t slot;
+    if (free_head_ != no_slot) {
+      slot = free_head_;
+      free_head_ = slots_[slot].dense_index;
+    }
+    else {
+      slot = slots_.size();
+      slots_.push_back(slot_entry{ 0, 0 });
+    }
+    slots_[slot].dense_index = std::uint32_t(values_.size() - 1);
+    dense_to_slot_.push_back(std::uint32_t(slot));
+    return { slot, slots_[slot].generation };
+  }
+
+  // The object in slot, or nullptr if generation is stale
+  T* find(size_t slot, std::uint32_t generation) {
+    if (!contains(slot, generation)) {
+      return nullptr;
+    }
+    return &values_[slots_[slot].dense_index];
+  }
+
+  const T* find(size_t slot, std::uint32_t generation) const {
+    return const_cast<slot_map*>(this)->find(slot, generation);
+  }
+
+  // A free slot keeps its generation and links the free list through
+  // dense_index, so matching the generation is not enough: the slot
+  // must also be the one its dense_index points back to
+  bool contains(size_t slot, std::uint32_t generation) const {
+    if (slot >= slots_.size() || slots_[slot].generation != generation) {
+      return false;
+    }
+    size_t dense_index = slots_[slot].dense_index;
+    return dense_index < values_.size() && dense_to_slot_[dense_index] == slot;
+  }
+
+  // Erases the object in slot by moving the last object into its place.
+  // Returns false if generation is stale.
+  bool erase(size_t slot, std::uint32_t generation) {
+    if (!contains(slot, generation)) {
+      return false;
+    }
+    size_t hole = slots_[slot].dense_index;
+    size_t last = values_.size() - 1;
+    if (hole != last) {
+      values_[hole] = std::move(values_[last]);
+      dense_to_slot_[hole] = dense_to_slot_[last];
+      slots_[dense_to_slot_[hole]].dense_index = std::uint32_t(hole);
+    }
+    values_.pop_back();
+    dense_to_slot_.pop_back();
+    ++slots_[slot].generation;
+    slots_[slot].dense_index = free_head_;
+    free_head_ = std::uint32_t(slot);
+    return true;
+  }
+
+  // Number of slots ever handed out, live or free
+  size_t num_slots() const {
+    return slots_.size();
+  }
+
+  size_t size() const {
+    return values_.size();
+  }
+
+  // The live objects, contiguous, in no particular order
+  span<T> values() {
+    return span<T>(values_.data(), values_.size());
+  }
+
+  span<const T> values() const {
+    return span<const T>(values_.data(), values_.size());
+  }
+
+ private:
+  // Free slots link to the next free slot through dense_index, and the
+  // last one holds no_slot. Their generation was bumped on erase, so no
+  // handle handed out before matches it.
+  struct slot_entry {
+    std::uint32_t dense_index;
+    std::uint32_t generation;
+  };
+
+  std::vector<T> values_;
+  std::vector<std::uint32_t> dense_to_slot_;
+  std::vector<slot_entry> slots_;
+  std::uint32_t free_head_ = no_slot;
+};
+
+// One slot_map per alternative, addressed by variant_handle<Ts...>
+template <typename... Ts>
+class variant_slot_maps {
+ public:
+  using handle_type = variant_handle<Ts...>;
+
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  template <typename X, typename... TArgs>
+  handle_type emplace(TArgs&&... args) {
+    constexpr size_t index = index_of_type<X, Ts...>::value;
+    static_assert(index != size_t(-1),
+                  "X is not one of the alternatives of these slot maps");
+    slot_map<X>& map = std::get<index>(maps_);
+    if (map.num_slots() >= handle_type::max_slots &&
+        map.size() == map.num_slots()) {
+      throw std::length_error("variant_slot_maps: slot map is full");
+    }
+    std::pair<size_t, std::uint32_t> slot =
+        map.emplace(std::forward<TArgs>(args)...);
+    return handle_type(index, slot.first, slot.second);
+  }
+
+  // Returns false if the handle is stale
+  bool erase(handle_type handle) {
+    return erase_table[handle.type_index()](*this, handle);
+  }
+
+  bool contains(handle_type handle) const {
+    return get(handle) != nullptr;
+  }
+
+  // Current address of the object, or nullptr if the handle is stale
+  void* get(handle_type handle) const {
+    return get_table[handle.type_index()](*this, handle);
+  }
+
+  // Throws std::out_of_range if the handle is stale
+  variant_ptr<Ts...> resolve(handle_type handle) {
+    return variant_ptr_access<variant_ptr<Ts...>>::make(
+        checked_get(handle), handle.type_index());
+  }
+
+  variant_ptr<const Ts...> resolve(handle_type handle) const {
+    return variant_ptr_access<variant_ptr<const Ts...>>::make(
+        checked_get(handle), handle.type_index());
+  }
+
+  // Throws std::out_of_range if the handle is stale
+  template <typename TVisitor, typename... TExtras>
+  decltype(auto) visit(
+      handle_type handle, TVisitor&& visitor, TExtras&&... extras) {
+    return visit_dispatch<Ts...>::visit(
+        handle.type_index(), checked_get(handle), visitor, extras...);
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  decltype(auto) visit(
+      handle_type handle, TVisitor&& visitor, TExtras&&... extras) const {
+    return visit_dispatch<const Ts...>::visit(
+        handle.type_index(), checked_get(handle), visitor, extras...);
+  }
+
+  template <typename X>
+  slot_map<X>& map() {
+    return std::get<index_of_type<X, Ts...>::value>(maps_);
+  }
+
+  template <typename X>
+  const slot_map<X>& map() const {
+    return std::get<index_of_type<X, Ts...>::value>(maps_);
+  }
+
+  // Visits every live object, one alternative after the other. Like
+  // visit_grouped, a visitor providing visit_span(span<U>) gets each
+  // alternative's objects in one call.
+  template <typename TVisitor>
+  void visit_all(TVisitor&& visitor) {
+    visit_all_impl(visitor, std::index_sequence_for<Ts...>{});
+  }
+
+ private:
+  template <size_t I>
+  static void* get_as(const variant_slot_maps& maps, handle_type handle) {
+    return const_cast<type_at<I, Ts...>*>(std::get<I>(maps.maps_).find(
+        handle.slot(), handle.generation()));
+  }
+
+  template <size_t I>
+  static bool erase_as(variant_slot_maps& maps, handle_type handle) {
+    return std::get<I>(maps.maps_).erase(handle.slot(), handle.generation());
+  }
+
+  template <size_t... Is>
+  static constexpr std::array<void* (*)(const variant_slot_maps&, handle_type),
+                              sizeof...(Ts)>
+  make_get_table(std::index_sequence<Is...>) {
+    return { &get_as<Is>... };
+  }
+
+  template <size_t... Is>
+  static constexpr std::array<bool (*)(variant_slot_maps&, handle_type),
+                              sizeof...(Ts)>
+  make_erase_table(std::index_sequence<Is...>) {
+    return { &erase_as<Is>... };
+  }
+
+  static constexpr auto get_table =
+      make_get_table(std::index_sequence_for<Ts...>{});
+
+  static constexpr auto erase_table =
+      make_erase_table(std::index_sequence_for<Ts...>{});
+
+  void* checked_get(handle_type handle) const {
+    void* ptr = get(handle);
+    if (ptr == nullptr) {
+      throw std::out_of_range("variant_slot_maps: stale handle");
+    }
+    return ptr;
+  }
+
+  template <typename TVisitor, size_t... Is>
+  void visit_all_impl(TVisitor& visitor, std::index_sequence<Is...>) {
+    (visit_values(visitor, std::get<Is>(maps_).values()), ...);
+  }
+
+  template <typename TVisitor, typename U>
+  static void visit_values(TVisitor& visitor, span<U> values) {
+    if constexpr (has_visit_span<TVisitor, span<U>>::value) {
+      if (!values.empty()) {
+        visitor.visit_span(values);
+      }
+    }
+    else {
+      for (U& u : values) {
+        visitor.visit(u);
+      }
+    }
+  }
+
+  std::tuple<slot_map<Ts>...> maps_;
+};
+
+}
+
+#endif /* _LIUS_TOOLS_VARIANT_SLOT_MAP_H_ */
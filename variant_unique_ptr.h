@@ -0,0 +1,268 @@
+#ifndef _LIUS_TOOLS_VARIANT_UNIQUE_PTR_H_
+#define _LIUS_TOOLS_VARIANT_UNIQUE_PTR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "variant_ptr.h"
+#include "variant_ref32.h"
+
+namespace lius_tools {
+
+// Exclusive ownership:
+//
+// A variant_unique_ptr owns its pointee like a std::unique_ptr, and
+// destroys it through a table indexed by the type index, so the
+// alternatives need no common base or virtual destructor:
+//
+// using HandPtr = variant_unique_ptr<Rock, Paper, Scissors>;
+// HandPtr hand = HandPtr::make<Paper>();
+// hand.visit(get_description);
+//
+// Each alternative is destroyed by variant_deleter<T>, which calls
+// delete by default. Objects that come from a pool specialize it to
+// return them there instead:
+//
+// template <>
+// struct variant_deleter<Particle> {
+//   static void destroy(Particle* particle) {
+//     particle_pool.release(particle);
+//   }
+// };
+//
+// make() allocates with new, so it only pairs with the default deleter;
+// pooled objects are adopted with the constructor instead.
+//
+// variant_unique_ptr is a pointer and a type index, two words.
+// packed_variant_unique_ptr stores the type index in the low bits of
+// the pointer instead, which needs every alternative to be aligned to
+// at least 2^tag_bits bytes.
+template <typename T>
+struct variant_deleter {
+  static void destroy(T* ptr) {
+    delete ptr;
+  }
+};
+
+// Types whose objects can be moved to another address with memcpy,
+// without running their move constructor and destructor. Specialize it
+// for other such types.
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+// Move constructs [first, last) into uninitialized memory at out and
+// destroys the originals, with a single memcpy for trivially
+// relocatable types. Containers of variant_unique_ptrs can grow with it.
+template <typename T>
+T* relocate(T* first, T* last, T* out) {
+  if constexpr (is_trivially_relocatable<T>::value) {
+    std::memcpy(static_cast<void*>(out), static_cast<const void*>(first),
+                (last - first) * sizeof(T));
+    return out + (last - first);
+  }
+  else {
+    for (; first != last; ++first, ++out) {
+      new (out) T(std::move(*first));
+      first->~T();
+    }
+    return out;
+  }
+}
+
+namespace {
+// A pointer and a type index side by side
+struct wide_tagged_storage {
+  void* ptr;
+  size_t type_index;
+
+  void* get() const { return ptr; }
+  size_t index() const { return type_index; }
+  void set(void* p, size_t i) { ptr = p; type_index = i; }
+};
+
+// The type index in the low tag_bits bits of the pointer
+template <size_t tag_bits>
+struct packed_tagged_storage {
+  static constexpr std::uintptr_t tag_mask =
+      (std::uintptr_t(1) << tag_bits) - 1;
+
+  std::uintptr_t word;
+
+  void* get() const { return reinterpret_cast<void*>(word & ~tag_mask); }
+  size_t index() const { return size_t(word & tag_mask); }
+  void set(void* p, size_t i) {
+    word = reinterpret_cast<std::uintptr_t>(p) | std::uintptr_t(i);
+  }
+};
+
+template <typename... Ts>
+constexpr size_t min_alignment() {
+  constexpr size_t alignments[] = { alignof(Ts)... };
+  size_t minimum = alignments[0];
+  for (size_t alignment : alignments) {
+    minimum = alignment < minimum ? alignment : minimum;
+  }
+  return minimum;
+}
+
+template <typename... Ts>
+struct unique_deleter {
+  template <typename X>
+  static void destroy_as(void* ptr) {
+    variant_deleter<typename std::remove_const<X>::type>::destroy(
+        static_cast<typename std::remove_const<X>::type*>(ptr));
+  }
+
+  static void destroy(void* ptr, size_t type_index) {
+    static constexpr void (*table[])(void*) = { &destroy_as<Ts>... };
+    table[type_index](ptr);
+  }
+};
+}
+
+template <bool packed, typename... Ts>
+class basic_variant_unique_ptr {
+ public:
+  static constexpr size_t num_types = sizeof...(Ts);
+
+  static constexpr size_t tag_bits = bits_for(num_types);
+
+  static_assert(!packed || min_alignment<Ts...>() >= (size_t(1) << tag_bits),
+                "the alternatives are not aligned enough to hold the type "
+                "index in the low bits of the pointer; use "
+                "variant_unique_ptr");
+
+  // The alternative at position I of Ts...
+  template <size_t I>
+  using type = type_at<I, Ts...>;
+
+  // Constructs an X with new
+  template <typename X, typename... TArgs>
+  static basic_variant_unique_ptr make(TArgs&&... args) {
+    return basic_variant_unique_ptr(new X(std::forward<TArgs>(args)...));
+  }
+
+  // Owns nothing
+  basic_variant_unique_ptr() {
+    storage_.set(nullptr, 0);
+  }
+
+  basic_variant_unique_ptr(std::nullptr_t) :
+      basic_variant_unique_ptr() {}
+
+  // Takes ownership of ptr, which variant_deleter<X> destroys
+  template <typename X>
+  explicit basic_variant_unique_ptr(X* ptr) {
+    static_assert(index_of_type<X, Ts...>::value != size_t(-1),
+                  "X is not one of the alternatives of this "
+                  "variant_unique_ptr");
+    storage_.set(const_cast<void*>(static_cast<const void*>(ptr)),
+                 index_of_type<X, Ts...>::value);
+  }
+
+  basic_variant_unique_ptr(basic_variant_unique_ptr&& other) noexcept :
+      storage_(other.storage_) {
+    other.storage_.set(nullptr, 0);
+  }
+
+  // Takes other's pointee and destroys the one this owned, leaving
+  // other empty
+  basic_variant_unique_ptr& operator=(
+      basic_variant_unique_ptr&& other) noexcept {
+    if (this != &other) {
+      storage_type owned = storage_;
+      storage_ = other.storage_;
+      other.storage_.set(nullptr, 0);
+      if (owned.get() != nullptr) {
+        unique_deleter<Ts...>::destroy(owned.get(), owned.index());
+      }
+    }
+    return *this;
+  }
+
+  basic_variant_unique_ptr(const basic_variant_unique_ptr&) = delete;
+  basic_variant_unique_ptr& operator=(
+      const basic_variant_unique_ptr&) = delete;
+
+  ~basic_variant_unique_ptr() {
+    reset();
+  }
+
+  void reset() {
+    if (get() != nullptr) {
+      unique_deleter<Ts...>::destroy(get(), type_index());
+    }
+    storage_.set(nullptr, 0);
+  }
+
+  // Gives up ownership, returning a view of the pointee
+  variant_ptr<Ts...> release() {
+    variant_ptr<Ts...> released = ptr();
+    storage_.set(nullptr, 0);
+    return released;
+  }
+
+  explicit operator bool() const {
+    return get() != nullptr;
+  }
+
+  // A non-owning view, valid as long as this owns the pointee
+  variant_ptr<Ts...> ptr() const {
+    return variant_ptr_access<variant_ptr<Ts...>>::make(get(), type_index());
+  }
+
+  // Position of X inside Ts...
+  template <typename X>
+  static constexpr size_t index_of() {
+    return index_of_type<X, Ts...>::value;
+  }
+
+  template <typename X>
+  bool has_type() const {
+    constexpr bool is_x[] = { std::is_same<X, Ts>::value... };
+    return is_x[type_index()];
+  }
+
+  template <typename TVisitor, typename... TExtras>
+  decltype(auto) visit(
+      TVisitor&& visitor, TExtras&&... extras) const {
+    return visit_dispatch<Ts...>::visit(
+        type_index(), get(), visitor, extras...);
+  }
+
+  // The raw pointee, without any type information
+  void* get() const {
+    return storage_.get();
+  }
+
+  // Position of the pointee's type inside Ts...
+  size_t type_index() const {
+    return storage_.index();
+  }
+
+ private:
+  using storage_type = typename std::conditional<
+    packed, packed_tagged_storage<tag_bits>, wide_tagged_storage>::type;
+
+  storage_type storage_;
+};
+
+template <typename... Ts>
+using variant_unique_ptr = basic_variant_unique_ptr<false, Ts...>;
+
+template <typename... Ts>
+using packed_variant_unique_ptr = basic_variant_unique_ptr<true, Ts...>;
+
+// A move copies the bytes and empties the source, whose destructor then
+// does nothing, so relocating one is just copying its bytes
+template <bool packed, typename... Ts>
+struct is_trivially_relocatable<basic_variant_unique_ptr<packed, Ts...>>
+    : std::true_type {};
+
+}
+
+#endif /* _LIUS_TOOLS_VARIANT_UNIQUE_PTR_H_ */